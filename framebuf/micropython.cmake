@@ -22,10 +22,16 @@ set(JPG_DIR ${CMAKE_CURRENT_LIST_DIR}/tjpgd)
 set(JPG_SRC ${JPG_DIR}/tjpgd.c)
 set(JPG_INC ${JPG_DIR})
 
+# png, inflated and deflated with the zlib of gfx font
+set(PNG_DIR ${CMAKE_CURRENT_LIST_DIR}/png)
+set(PNG_SRC ${PNG_DIR}/pngdec.c ${PNG_DIR}/pngenc.c)
+set(PNG_INC ${PNG_DIR})
+
 target_sources(usermod_framebuf_plus INTERFACE
     ${MOD_SRC}
     ${GFX_SRC}
     ${JPG_SRC}
+    ${PNG_SRC}
 )
 
 # Add the current directory as an include directory.
@@ -33,6 +39,7 @@ target_include_directories(usermod_framebuf_plus INTERFACE
     ${MOD_INC}
     ${GFX_INC}
     ${JPG_INC}
+    ${PNG_INC}
 )
 
 # Link our INTERFACE library to the usermod target.
@@ -40,6 +40,20 @@
 
 #define SUPPORT_GFX_FONT (1)
 #define SUPPORT_JPG (1)
+#define SUPPORT_PNG (1)
+#define SUPPORT_RAW (1) // raw, BMP and PGM/PBM images
+#define SUPPORT_DITHER (1) // dithered conversion to gray and mono formats
+#define SUPPORT_SAVE (1) // save_pgm() and save_png() screenshots, save_png() needs SUPPORT_PNG
+#define SUPPORT_DAMAGE (1) // damaged region of the drawing methods, for partial refreshes
+
+// File and buffer input shared by the image decoders
+#define SUPPORT_IMG_IO (SUPPORT_JPG || SUPPORT_PNG || SUPPORT_RAW)
+
+// LRU cache of the images decoded by jpg() and png(), kept alive from a root pointer
+#define SUPPORT_IMG_CACHE ((SUPPORT_JPG || SUPPORT_PNG) && !MICROPY_ENABLE_DYNRUNTIME)
+
+// DisplayList of drawing calls, replayed into a strip frame buffer a band at a time
+#define SUPPORT_DISPLAY_LIST (!MICROPY_ENABLE_DYNRUNTIME)
 
 #if SUPPORT_GFX_FONT
 #include "gfxfont/gfxfont.h"
@@ -49,25 +63,116 @@
 
 #if SUPPORT_JPG
 #include "tjpgd.h"
+#endif
+
+#if SUPPORT_PNG
+#include "pngdec.h"
+#if SUPPORT_SAVE
+#include "pngenc.h"
+#endif
+#endif
+
+#if SUPPORT_IMG_IO || SUPPORT_SAVE || SUPPORT_DISPLAY_LIST
 #include "extmod/vfs.h"
+#include "py/mperrno.h"
 #include "py/stream.h"
 #endif
 
+// JpegDecoder(threads=n) decodes restart intervals on POSIX threads (unix port)
+#if SUPPORT_JPG && MICROPY_PY_THREAD && (defined(__unix__) || defined(__APPLE__))
+#define SUPPORT_JPG_THREADS (1)
+#include <pthread.h>
+#include <unistd.h>
+#else
+#define SUPPORT_JPG_THREADS (0)
+#endif
+
+#if SUPPORT_DAMAGE
+#define DAMAGE_RECTS (8)
+
+// Damaged region of a frame buffer, a few rects that are merged when they
+// touch, or into the one growing least when all are used
+typedef struct {
+    uint16_t x0, y0, x1, y1; // x1 and y1 excluded
+} damage_rect_t;
+
+typedef struct {
+    uint8_t n;
+    damage_rect_t rects[DAMAGE_RECTS];
+} framebuf_damage_t;
+#endif
+
 typedef struct _mp_obj_framebuf_t {
     mp_obj_base_t base;
     mp_obj_t buf_obj; // need to store this to prevent GC from reclaiming buf
     void *buf;
+    mp_obj_t back_obj; // back buffer of swap(), MP_OBJ_NULL for a single buffer
+    void *back;
     uint16_t width, height, stride;
+    uint16_t clip_x0, clip_y0, clip_x1, clip_y1; // drawing window of set_clip(), ends exclusive
     uint8_t format;
+    uint8_t xoff, yoff; // pixels of a view before its own in its first byte, yoff for MVLSB
+    bool view; // shares the buffer of the frame buffer in buf_obj
+    const uint8_t *top_buf; // buffer of the top frame buffer that buf of a view points into
+    uint8_t rotate; // ROTATE_* flags of set_rotation(), width and height are those drawn to
+    const uint8_t *tone; // curve of the colour to gray conversions, NULL for linear
+#if SUPPORT_DAMAGE
+    framebuf_damage_t *damage; // NULL for the frame buffers used internally
+    uint16_t damage_x, damage_y; // origin of a view in the frame buffer whose damage it shares
+#endif
 #if SUPPORT_GFX_FONT
     GFXfont *gfxFont;
 #endif
+#if SUPPORT_DISPLAY_LIST
+    mp_obj_t record; // DisplayList of record(), MP_OBJ_NULL when not recording
+#endif
 } mp_obj_framebuf_t;
 
 #if !MICROPY_ENABLE_DYNRUNTIME
 STATIC const mp_obj_type_t mp_type_framebuf;
 #endif
 
+#if SUPPORT_DISPLAY_LIST
+// The FrameBuffer methods a DisplayList records
+enum {
+    DL_FILL,
+    DL_FILL_RECT,
+    DL_PIXEL,
+    DL_HLINE,
+    DL_VLINE,
+    DL_RECT,
+    DL_LINE,
+    DL_ELLIPSE,
+    #if MICROPY_PY_ARRAY
+    DL_POLY,
+    #endif
+    DL_TEXT,
+    DL_BLIT,
+    DL_BLIT_SCALED,
+    #if SUPPORT_DITHER
+    DL_CONVERT_FROM,
+    #endif
+    #if SUPPORT_GFX_FONT
+    DL_WRITE,
+    #endif
+    #if SUPPORT_JPG
+    DL_JPG,
+    #endif
+    #if SUPPORT_PNG
+    DL_PNG,
+    #endif
+    #if SUPPORT_RAW
+    DL_LOAD_RAW,
+    DL_BMP,
+    DL_PGM,
+    #endif
+};
+
+STATIC void record_call(mp_obj_framebuf_t *fb, unsigned int op, size_t n_args, const mp_obj_t *args, mp_map_t *kw_args, mp_obj_t ret);
+#else
+#define record_call(...)
+#endif
+
 typedef void (*setpixel_t)(const mp_obj_framebuf_t *, unsigned int, unsigned int, uint32_t);
 typedef uint32_t (*getpixel_t)(const mp_obj_framebuf_t *, unsigned int, unsigned int);
 typedef void (*fill_rect_t)(const mp_obj_framebuf_t *, unsigned int, unsigned int, unsigned int, unsigned int, uint32_t);
@@ -347,52 +452,314 @@ STATIC mp_framebuf_p_t formats[] = {
     [FRAMEBUF_RGB888] = {rgb888_setpixel, rgb888_getpixel, rgb888_fill_rect},
 };
 
+// Mapping of the coordinates drawn to onto the buffer, x and y are exchanged
+// first, then mirrored within the buffer
+#define ROTATE_SWAP   (1)
+#define ROTATE_FLIP_X (2)
+#define ROTATE_FLIP_Y (4)
+
+// Width and height of the buffer, those drawn to are exchanged by a rotation of 90 or 270
+static inline mp_int_t panel_width(const mp_obj_framebuf_t *fb) {
+    return fb->rotate & ROTATE_SWAP ? fb->height : fb->width;
+}
+
+static inline mp_int_t panel_height(const mp_obj_framebuf_t *fb) {
+    return fb->rotate & ROTATE_SWAP ? fb->width : fb->height;
+}
+
+static inline void rotate_point(const mp_obj_framebuf_t *fb, unsigned int *x, unsigned int *y) {
+    unsigned int px = fb->rotate & ROTATE_SWAP ? *y : *x;
+    unsigned int py = fb->rotate & ROTATE_SWAP ? *x : *y;
+    *x = fb->rotate & ROTATE_FLIP_X ? panel_width(fb) - 1 - px : px;
+    *y = fb->rotate & ROTATE_FLIP_Y ? panel_height(fb) - 1 - py : py;
+}
+
+// ROTATE_* flags of a clockwise rotation by rotation degrees of what is
+// mirrored first, across its vertical axis for mirror_x
+STATIC uint8_t rotate_flags(mp_int_t rotation, bool mirror_x, bool mirror_y) {
+    uint8_t rotate;
+    switch (rotation) {
+        case 0:
+            rotate = 0;
+            break;
+        case 90:
+            rotate = ROTATE_SWAP | ROTATE_FLIP_X;
+            break;
+        case 180:
+            rotate = ROTATE_FLIP_X | ROTATE_FLIP_Y;
+            break;
+        case 270:
+            rotate = ROTATE_SWAP | ROTATE_FLIP_Y;
+            break;
+        default:
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid rotation"));
+    }
+    // a mirror of x is one of y once they are exchanged
+    bool swap = rotate & ROTATE_SWAP;
+    if (mirror_x) {
+        rotate ^= swap ? ROTATE_FLIP_Y : ROTATE_FLIP_X;
+    }
+    if (mirror_y) {
+        rotate ^= swap ? ROTATE_FLIP_X : ROTATE_FLIP_Y;
+    }
+    return rotate;
+}
+
+// Maps the rect x, y, w, h by the ROTATE_* flags rotate onto an area of pw by
+// ph pixels, a row becomes a column when x and y are exchanged
+STATIC void transform_rect(uint8_t rotate, mp_int_t pw, mp_int_t ph, mp_int_t *x, mp_int_t *y, mp_int_t *w, mp_int_t *h) {
+    if (rotate & ROTATE_SWAP) {
+        mp_int_t t = *x;
+        *x = *y;
+        *y = t;
+        t = *w;
+        *w = *h;
+        *h = t;
+    }
+    if (rotate & ROTATE_FLIP_X) {
+        *x = pw - *x - *w;
+    }
+    if (rotate & ROTATE_FLIP_Y) {
+        *y = ph - *y - *h;
+    }
+}
+
+// Maps the rect x, y, w, h drawn to onto the buffer
+static inline void rotate_rect(const mp_obj_framebuf_t *fb, mp_int_t *x, mp_int_t *y, mp_int_t *w, mp_int_t *h) {
+    transform_rect(fb->rotate, panel_width(fb), panel_height(fb), x, y, w, h);
+}
+
+#if SUPPORT_DAMAGE
+STATIC uint32_t damage_area(const damage_rect_t *r) {
+    return (uint32_t)(r->x1 - r->x0) * (r->y1 - r->y0);
+}
+
+STATIC void damage_union(damage_rect_t *r, const damage_rect_t *d) {
+    r->x0 = MIN(r->x0, d->x0);
+    r->y0 = MIN(r->y0, d->y0);
+    r->x1 = MAX(r->x1, d->x1);
+    r->y1 = MAX(r->y1, d->y1);
+}
+
+// Adds the part of the rect x, y, w, h inside the clip window of fb to its damaged region
+STATIC void damage_add(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y, mp_int_t w, mp_int_t h) {
+    framebuf_damage_t *dmg = fb->damage;
+    if (dmg == NULL || w <= 0 || h <= 0) {
+        return;
+    }
+    damage_rect_t r = {
+        .x0 = MAX(fb->clip_x0, MIN(x, fb->clip_x1)),
+        .y0 = MAX(fb->clip_y0, MIN(y, fb->clip_y1)),
+        .x1 = MIN(fb->clip_x1, MAX(x + w, fb->clip_x0)),
+        .y1 = MIN(fb->clip_y1, MAX(y + h, fb->clip_y0)),
+    };
+    if (r.x0 >= r.x1 || r.y0 >= r.y1) {
+        return;
+    }
+    if (fb->rotate) {
+        // damage is in the coordinates of the buffer, as the display refreshes it
+        mp_int_t rx = r.x0, ry = r.y0, rw = r.x1 - r.x0, rh = r.y1 - r.y0;
+        rotate_rect(fb, &rx, &ry, &rw, &rh);
+        r.x0 = rx;
+        r.y0 = ry;
+        r.x1 = rx + rw;
+        r.y1 = ry + rh;
+    }
+    r.x0 += fb->damage_x;
+    r.x1 += fb->damage_x;
+    r.y0 += fb->damage_y;
+    r.y1 += fb->damage_y;
+
+    for (unsigned int i = 0; i < dmg->n; i++) {
+        const damage_rect_t *d = &dmg->rects[i];
+        if (d->x0 <= r.x0 && r.x1 <= d->x1 && d->y0 <= r.y0 && r.y1 <= d->y1) {
+            return; // already damaged, e.g. the next pixel of a glyph
+        }
+    }
+
+    for (;;) {
+        // take in the rects that overlap or touch r, until none does
+        unsigned int i;
+        for (i = 0; i < dmg->n; i++) {
+            const damage_rect_t *d = &dmg->rects[i];
+            if (d->x0 <= r.x1 && r.x0 <= d->x1 && d->y0 <= r.y1 && r.y0 <= d->y1) {
+                break;
+            }
+        }
+        if (i == dmg->n) {
+            if (dmg->n < DAMAGE_RECTS) {
+                dmg->rects[dmg->n++] = r;
+                return;
+            }
+            // all used, merge with the rect whose union with r adds the least area
+            uint32_t best = UINT32_MAX;
+            for (unsigned int j = 0; j < dmg->n; j++) {
+                damage_rect_t u = r;
+                damage_union(&u, &dmg->rects[j]);
+                uint32_t grow = damage_area(&u) - damage_area(&dmg->rects[j]);
+                if (grow < best) {
+                    best = grow;
+                    i = j;
+                }
+            }
+        }
+        damage_union(&r, &dmg->rects[i]);
+        dmg->rects[i] = dmg->rects[--dmg->n];
+    }
+}
+
+STATIC void damage_clear(const mp_obj_framebuf_t *fb) {
+    if (fb->damage != NULL) {
+        fb->damage->n = 0;
+    }
+}
+#else
+#define damage_add(fb, x, y, w, h)
+#endif
+
+// Sets the drawing window to the whole frame buffer
+STATIC void clip_reset(mp_obj_framebuf_t *fb) {
+    fb->clip_x0 = 0;
+    fb->clip_y0 = 0;
+    fb->clip_x1 = fb->width;
+    fb->clip_y1 = fb->height;
+}
+
+static inline bool clip_contains(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y) {
+    return fb->clip_x0 <= x && x < fb->clip_x1 && fb->clip_y0 <= y && y < fb->clip_y1;
+}
+
 STATIC inline void setpixel(const mp_obj_framebuf_t *fb, unsigned int x, unsigned int y, uint32_t col) {
-    formats[fb->format].setpixel(fb, x, y, col);
+    if (fb->rotate) {
+        rotate_point(fb, &x, &y);
+    }
+    formats[fb->format].setpixel(fb, x + fb->xoff, y + fb->yoff, col);
 }
 
 STATIC void setpixel_checked(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y, mp_int_t col, mp_int_t mask) {
-    if (mask && 0 <= x && x < fb->width && 0 <= y && y < fb->height) {
+    if (mask && clip_contains(fb, x, y)) {
         setpixel(fb, x, y, col);
+        damage_add(fb, x, y, 1, 1);
     }
 }
 
 STATIC inline uint32_t getpixel(const mp_obj_framebuf_t *fb, unsigned int x, unsigned int y) {
-    return formats[fb->format].getpixel(fb, x, y);
+    if (fb->rotate) {
+        rotate_point(fb, &x, &y);
+    }
+    return formats[fb->format].getpixel(fb, x + fb->xoff, y + fb->yoff);
+}
+
+// Fills a rect within the clip window, the caller adds it to the damage
+STATIC void fill_rect_inside(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y, mp_int_t w, mp_int_t h, uint32_t col) {
+    if (fb->rotate) {
+        // spans become columns of the buffer with a rotation of 90 or 270
+        rotate_rect(fb, &x, &y, &w, &h);
+    }
+    formats[fb->format].fill_rect(fb, x + fb->xoff, y + fb->yoff, w, h, col);
 }
 
 STATIC void fill_rect(const mp_obj_framebuf_t *fb, int x, int y, int w, int h, uint32_t col) {
-    if (h < 1 || w < 1 || x + w <= 0 || y + h <= 0 || y >= fb->height || x >= fb->width) {
+    if (h < 1 || w < 1 || x + w <= fb->clip_x0 || y + h <= fb->clip_y0 || y >= fb->clip_y1 || x >= fb->clip_x1) {
         // No operation needed.
         return;
     }
 
-    // clip to the framebuffer
-    int xend = MIN(fb->width, x + w);
-    int yend = MIN(fb->height, y + h);
-    x = MAX(x, 0);
-    y = MAX(y, 0);
+    // clip to the drawing window
+    int xend = MIN(fb->clip_x1, x + w);
+    int yend = MIN(fb->clip_y1, y + h);
+    x = MAX(x, fb->clip_x0);
+    y = MAX(y, fb->clip_y0);
 
-    formats[fb->format].fill_rect(fb, x, y, xend - x, yend - y, col);
+    damage_add(fb, x, y, xend - x, yend - y);
+    fill_rect_inside(fb, x, y, xend - x, yend - y, col);
 }
 
 
-#if SUPPORT_JPG
+#if SUPPORT_IMG_IO
+#if SUPPORT_DITHER
+#define DITHER_NONE     (0)
+#define DITHER_FLOYD    (1) // Floyd-Steinberg error diffusion
+#define DITHER_ATKINSON (2) // Atkinson error diffusion, 3/4 of the error
+#define DITHER_BAYER    (3) // 4x4 ordered dithering
+
+// Row ditherer, see dither_row
+typedef struct {
+    uint8_t mode;
+    uint8_t levels; /* Gray levels of the target format */
+    mp_int_t width; /* Pixels per row */
+    unsigned int row; /* Rows done, selects the current error row */
+    int16_t *err; /* Error diffusion: 3 rows of width + 4 errors, in 1/16 of a gray level */
+} dither_t;
+#endif
+
+// File input is read in blocks of this size, with reads ending on IMG_FILE_ALIGN boundaries
+#define IMG_FILE_BUF (4096)
+#define IMG_FILE_ALIGN (512)
+
 // User defined device identifier
 typedef struct {
     // for file input function
     mp_obj_t fp; /* Input stream */
+    uint8_t *blk; /* Block buffer */
+    unsigned int blk_size;
+    unsigned int blk_index; /* Read position in the block buffer */
+    unsigned int blk_len; /* Number of bytes in the block buffer */
+    mp_off_t fpos; /* Stream position of the end of the block buffer */
 
     // for buffer input function
-    uint8_t *data;
+    mp_obj_t src; /* Keeps the buffer alive while a decode is in progress */
+    const uint8_t *data;
     unsigned int data_index;
     unsigned int data_len;
 
     // for output
-    uint8_t * fbuf; /* Output frame buffer */
-    unsigned int wfbuf; /* Width of the frame buffer [pix] */
+    const mp_obj_framebuf_t *fb; /* Output frame buffer */
+    mp_int_t x, y; /* Position of the image origin in the frame buffer */
+    #if SUPPORT_JPG
+    JRECT rgn; /* Region of the image to output, inside the frame buffer */
+    #if SUPPORT_DITHER
+    dither_t dither; /* Conversion of the output to a gray or mono format */
+    uint8_t *band; /* Gray values of an MCU row of rgn, for error diffusion */
+    #endif
+    #endif
 } IODEV;
+#endif
+
+#if SUPPORT_JPG
+// Size of the tjpgd work pool, enough for common baseline JPEGs
+#define JPG_POOL_SIZE (3100)
+// IDCT and MCU buffers for the largest MCU
+#define JPG_WORK_SIZE (4 * 64 * 2 + 64 + 6 * 64)
+// Worst case: input buffer, 4 quantization tables, 4 huffman tables, IDCT and MCU buffers
+#define JPG_POOL_MAX (JD_SZBUF + 4 * 256 + 4 * (16 + 3 * 256) + JPG_WORK_SIZE)
 
+#if SUPPORT_JPG_THREADS
+#define JPG_THREADS_MAX (8)
+
+// A decoder of some restart intervals, sharing the tables of the main one
+typedef struct {
+    JDEC jdec;
+    IODEV dev;
+    unsigned int first, count; /* Restart intervals to decode */
+    JRESULT res;
+    uint32_t work[JPG_WORK_SIZE / 4]; /* IDCT and MCU buffers */
+} jpg_worker_t;
+#endif
+
+// JpegDecoder keeps the tjpgd state and work pool between images, so that
+// decoding a series of images allocates nothing and reuses identical tables.
+typedef struct _mp_obj_jpegdec_t {
+    mp_obj_base_t base;
+    JDEC jdec;
+    IODEV dev;
+    uint8_t *pool;
+    unsigned int sz_pool;
+    #if SUPPORT_JPG_THREADS
+    unsigned int threads;
+    jpg_worker_t *workers; /* threads - 1 workers, allocated by the first parallel decode */
+    #endif
+} mp_obj_jpegdec_t;
 
 const char *jd_errors[] = {
     "Succeeded",
@@ -405,71 +772,259 @@ const char *jd_errors[] = {
     "Right format but not supported",
     "Not supported JPEG standard"
 };
+#endif
 
-static const uint8_t gs8_curve[] = {
-    0x00, 0x01, 0x01, 0x02, 0x03, 0x03, 0x04, 0x05,
-    0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
-    0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e,
-    0x56, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d,
-    0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e,
-    0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
-    0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf, 0xc1, 0xc2,
-    0xdd, 0xde, 0xdf, 0xe0, 0xe1, 0xe2, 0xe3, 0xe4,
-    0x00, 0x00, 0x00, 0x00, 0x5c, 0x3d, 0xcf, 0x3f,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0xa5, 0xa5, 0xa5, 0x58, 0x01, 0x00, 0x00,
-    0x74, 0x31, 0xc9, 0x3f, 0x18, 0x00, 0x00, 0x00,
-    0x6d, 0x61, 0x69, 0x6e, 0x00, 0x1a, 0x8f, 0x32,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+#if SUPPORT_PNG
+const char *png_errors[] = {
+    "Succeeded",
+    "Interrupted by output function",
+    "Device error or wrong termination of input stream",
+    "Insufficient memory for inflate",
+    "Data format error",
 };
+#endif
+
+#if SUPPORT_IMG_IO || SUPPORT_DITHER || SUPPORT_SAVE
+
+typedef uint32_t (*color_converts_t)(const mp_obj_framebuf_t *, uint8_t, uint8_t, uint8_t);
+
+static inline uint8_t rgb888_to_luma(uint8_t r, uint8_t g, uint8_t b) {
+    return (r * 38 + g * 75 + b * 15) >> 7;
+}
+
+// Gray level of r, g, b on fb: the luma, through the tone curve of fb
+static inline uint8_t rgb888_to_gray(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    uint8_t luma = rgb888_to_luma(r, g, b);
+    return fb->tone != NULL ? fb->tone[luma] : luma;
+}
+
+STATIC uint32_t rgb888_to_gs8(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return rgb888_to_gray(fb, r, g, b);
+}
+
+STATIC uint32_t rgb888_to_gs4(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return rgb888_to_gray(fb, r, g, b) >> 4;
+}
+
+STATIC uint32_t rgb888_to_gs2(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return rgb888_to_gray(fb, r, g, b) >> 6;
+}
 
-typedef uint32_t (*color_converts_t)(uint8_t, uint8_t, uint8_t);
+STATIC uint32_t rgb888_to_mono(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return rgb888_to_gray(fb, r, g, b) >> 7;
+}
 
-STATIC uint32_t rgb888_to_gs8(uint8_t r, uint8_t g, uint8_t b) {
-    uint32_t gamme_val = (r * 38 + g * 75 + b * 15) >> 7;
-    return gs8_curve[gamme_val];
+STATIC uint32_t rgb888_to_rgb565(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
 }
 
-STATIC uint32_t rgb888_to_gs4(uint8_t r, uint8_t g, uint8_t b) {
-    uint32_t gamme_val = (r * 38 + g * 75 + b * 15) >> 7;
-    return (gs8_curve[gamme_val] >> 4);
+STATIC uint32_t rgb888_to_rgb888(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return (r << 16) | (g << 8) | b;
 }
 
 STATIC color_converts_t converts[] = {
-    [FRAMEBUF_MVLSB]    = NULL,
-    [FRAMEBUF_RGB565]   = NULL,
-    [FRAMEBUF_GS2_HMSB] = NULL,
+    [FRAMEBUF_MVLSB]    = rgb888_to_mono,
+    [FRAMEBUF_RGB565]   = rgb888_to_rgb565,
+    [FRAMEBUF_GS2_HMSB] = rgb888_to_gs2,
     [FRAMEBUF_GS4_HMSB] = rgb888_to_gs4,
     [FRAMEBUF_GS8]      = rgb888_to_gs8,
-    [FRAMEBUF_MHLSB]    = NULL,
-    [FRAMEBUF_MHMSB]    = NULL,
+    [FRAMEBUF_MHLSB]    = rgb888_to_mono,
+    [FRAMEBUF_MHMSB]    = rgb888_to_mono,
     [FRAMEBUF_GS4_HLSB] = rgb888_to_gs4,
-    [FRAMEBUF_RGB888]   = NULL,
+    [FRAMEBUF_RGB888]   = rgb888_to_rgb888,
+};
+
+// Native colour of r, g, b on fb
+STATIC uint32_t img_color(const mp_obj_framebuf_t *fb, uint8_t r, uint8_t g, uint8_t b) {
+    return converts[fb->format](fb, r, g, b);
+}
+
+STATIC void native_to_rgb888(uint8_t format, uint32_t col, uint8_t *rgb) {
+    uint8_t g;
+    switch (format) {
+        case FRAMEBUF_RGB565:
+            rgb[0] = ((col >> 8) & 0xf8) | ((col >> 13) & 0x07);
+            rgb[1] = ((col >> 3) & 0xfc) | ((col >> 9) & 0x03);
+            rgb[2] = ((col << 3) & 0xf8) | ((col >> 2) & 0x07);
+            return;
+        case FRAMEBUF_RGB888:
+            rgb[0] = col >> 16;
+            rgb[1] = col >> 8;
+            rgb[2] = col;
+            return;
+        case FRAMEBUF_GS8:
+            g = col;
+            break;
+        case FRAMEBUF_GS4_HMSB:
+        case FRAMEBUF_GS4_HLSB:
+            g = col * 17;
+            break;
+        case FRAMEBUF_GS2_HMSB:
+            g = col * 85;
+            break;
+        default:
+            g = col ? 0xff : 0;
+            break;
+    }
+    rgb[0] = rgb[1] = rgb[2] = g;
+}
+
+#endif
+
+#if SUPPORT_DITHER
+STATIC const uint8_t bayer4[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
 };
 
+// Gray levels of the formats that are dithered, 0 for the others
+STATIC unsigned int dither_levels(uint8_t format) {
+    switch (format) {
+        case FRAMEBUF_MVLSB:
+        case FRAMEBUF_MHLSB:
+        case FRAMEBUF_MHMSB:
+            return 2;
+        case FRAMEBUF_GS2_HMSB:
+            return 4;
+        case FRAMEBUF_GS4_HMSB:
+        case FRAMEBUF_GS4_HLSB:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// Level of the gray value v at (x, y) of the frame buffer
+static inline unsigned int dither_bayer(unsigned int v, unsigned int levels, unsigned int x, unsigned int y) {
+    return (v * (levels - 1) * 16 + bayer4[y & 3][x & 3] * 255 + 127) / (255 * 16);
+}
+
+STATIC uint8_t dither_mode(mp_int_t mode) {
+    if (mode < DITHER_NONE || mode > DITHER_BAYER) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid dither"));
+    }
+    return mode;
+}
+
+STATIC void dither_init(dither_t *d, uint8_t mode, uint8_t format, mp_int_t width) {
+    d->levels = dither_levels(format);
+    d->mode = d->levels ? mode : DITHER_NONE;
+    d->width = width;
+    d->row = 0;
+    d->err = NULL;
+    if (d->mode == DITHER_FLOYD || d->mode == DITHER_ATKINSON) {
+        d->err = m_new0(int16_t, 3 * (width + 4));
+    }
+}
+
+STATIC void dither_deinit(dither_t *d) {
+    if (d->err != NULL) {
+        m_del(int16_t, d->err, 3 * (d->width + 4));
+        d->err = NULL;
+    }
+    d->mode = DITHER_NONE;
+}
+
+// Quantizes the next row of gray values to the levels of fb and draws it at
+// (x, y). Rows must come in order and inside fb. The error diffused to the
+// following rows is kept in fixed point, two guard entries on each side of
+// a row take what falls outside of it.
+STATIC void dither_row(dither_t *d, const uint8_t *gray, const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y) {
+    unsigned int levels = d->levels;
+    mp_int_t w = d->width;
+
+    if (d->mode == DITHER_BAYER) {
+        for (mp_int_t i = 0; i < w; i++) {
+            setpixel(fb, x + i, y, dither_bayer(gray[i], levels, x + i, y));
+        }
+        return;
+    }
+
+    mp_int_t n = w + 4;
+    int16_t *e0 = d->err + d->row % 3 * n + 2;
+    int16_t *e1 = d->err + (d->row + 1) % 3 * n + 2;
+    int16_t *e2 = d->err + (d->row + 2) % 3 * n + 2;
+    int step = 255 * 16 / (levels - 1);
+
+    for (mp_int_t i = 0; i < w; i++) {
+        int v = gray[i] * 16 + e0[i];
+        v = MAX(0, MIN(v, 255 * 16));
+        unsigned int q = (v + step / 2) / step;
+        int e = v - (int)q * step;
+        setpixel(fb, x + i, y, q);
+        if (d->mode == DITHER_FLOYD) {
+            e0[i + 1] += e * 7 / 16;
+            e1[i - 1] += e * 3 / 16;
+            e1[i] += e * 5 / 16;
+            e1[i + 1] += e / 16;
+        } else {
+            e /= 8;
+            e0[i + 1] += e;
+            e0[i + 2] += e;
+            e1[i - 1] += e;
+            e1[i] += e;
+            e1[i + 1] += e;
+            e2[i] += e;
+        }
+    }
+    memset(e0 - 2, 0, n * sizeof(int16_t)); // the row after next
+    d->row++;
+}
 #endif
 
+// Bits per pixel of each format
+STATIC const uint8_t format_bpp[] = {
+    [FRAMEBUF_MVLSB]    = 1,
+    [FRAMEBUF_RGB565]   = 16,
+    [FRAMEBUF_GS2_HMSB] = 2,
+    [FRAMEBUF_GS4_HMSB] = 4,
+    [FRAMEBUF_GS8]      = 8,
+    [FRAMEBUF_MHLSB]    = 1,
+    [FRAMEBUF_MHMSB]    = 1,
+    [FRAMEBUF_GS4_HLSB] = 4,
+    [FRAMEBUF_RGB888]   = 24,
+};
+
+// Bytes per row of a frame buffer, per 8-row page for MVLSB
+STATIC size_t framebuf_row_bytes(uint8_t format, mp_int_t stride) {
+    if (format == FRAMEBUF_MVLSB || format == FRAMEBUF_RGB888) {
+        return stride;
+    }
+    return (size_t)stride * format_bpp[format] / 8;
+}
+
+// Rounds stride up as the format needs, RGB888 strides are in bytes
+STATIC mp_int_t framebuf_stride(uint8_t format, mp_int_t stride) {
+    switch (format) {
+        case FRAMEBUF_MVLSB:
+        case FRAMEBUF_RGB565:
+        case FRAMEBUF_MHLSB:
+        case FRAMEBUF_MHMSB:
+            return (stride + 7) & ~7;
+        case FRAMEBUF_GS2_HMSB:
+            return (stride + 3) & ~3;
+        case FRAMEBUF_GS4_HMSB:
+        case FRAMEBUF_GS4_HLSB:
+            return (stride + 1) & ~1;
+        case FRAMEBUF_GS8:
+            return stride;
+        case FRAMEBUF_RGB888:
+            return stride * 3;
+        default:
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid format"));
+    }
+}
+
+// Bytes of the buffer of a frame buffer of the geometry of fb, views aside
+STATIC size_t framebuf_size(const mp_obj_framebuf_t *fb) {
+    size_t rows = fb->format == FRAMEBUF_MVLSB ? (panel_height(fb) + 7) / 8 : panel_height(fb);
+    return rows * framebuf_row_bytes(fb->format, fb->stride);
+}
 
 STATIC mp_obj_t framebuf_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args_in) {
-    mp_arg_check_num(n_args, n_kw, 4, 5, false);
+    mp_arg_check_num(n_args, n_kw, 4, 5, true);
 
     mp_obj_framebuf_t *o = mp_obj_malloc(mp_obj_framebuf_t, type);
     o->buf_obj = args_in[0];
@@ -477,6 +1032,7 @@ STATIC mp_obj_t framebuf_make_new(const mp_obj_type_t *type, size_t n_args, size
     mp_buffer_info_t bufinfo;
     mp_get_buffer_raise(args_in[0], &bufinfo, MP_BUFFER_WRITE);
     o->buf = bufinfo.buf;
+    size_t len = bufinfo.len;
 
     o->width = mp_obj_get_int(args_in[1]);
     o->height = mp_obj_get_int(args_in[2]);
@@ -486,33 +1042,48 @@ STATIC mp_obj_t framebuf_make_new(const mp_obj_type_t *type, size_t n_args, size
     } else {
         o->stride = o->width;
     }
-
-    switch (o->format) {
-        case FRAMEBUF_MVLSB:
-        case FRAMEBUF_RGB565:
-        case FRAMEBUF_MHLSB:
-        case FRAMEBUF_MHMSB:
-            o->stride = (o->stride + 7) & ~7;
-            break;
-        case FRAMEBUF_GS2_HMSB:
-            o->stride = (o->stride + 3) & ~3;
-            break;
-        case FRAMEBUF_GS4_HMSB:
-        case FRAMEBUF_GS4_HLSB:
-            o->stride = (o->stride + 1) & ~1;
-            break;
-        case FRAMEBUF_GS8:
-            break;
-        case FRAMEBUF_RGB888:
-            o->stride = o->stride * 3;
-            break;
-        default:
-            mp_raise_ValueError(MP_ERROR_TEXT("invalid format"));
+    o->stride = framebuf_stride(o->format, o->stride);
+    clip_reset(o);
+
+    // back=buffer, a second buffer of swap(), starts as a copy of the first
+    mp_obj_t back_in = mp_const_none;
+    for (size_t i = 0; i < n_kw; i++) {
+        if (args_in[n_args + 2 * i] != MP_OBJ_NEW_QSTR(MP_QSTR_back)) {
+            mp_raise_TypeError(MP_ERROR_TEXT("unexpected keyword argument"));
+        }
+        back_in = args_in[n_args + 2 * i + 1];
+    }
+    o->back_obj = MP_OBJ_NULL;
+    o->back = NULL;
+    if (back_in != mp_const_none) {
+        if (len < framebuf_size(o)) {
+            mp_raise_ValueError(MP_ERROR_TEXT("buffer too small"));
+        }
+        mp_get_buffer_raise(back_in, &bufinfo, MP_BUFFER_WRITE);
+        if (bufinfo.len < framebuf_size(o)) {
+            mp_raise_ValueError(MP_ERROR_TEXT("back buffer too small"));
+        }
+        o->back_obj = back_in;
+        o->back = bufinfo.buf;
+        memcpy(o->back, o->buf, framebuf_size(o));
     }
+    o->xoff = 0;
+    o->yoff = 0;
+    o->view = false;
+    o->rotate = 0;
+    o->tone = NULL;
+#if SUPPORT_DAMAGE
+    o->damage = m_new0(framebuf_damage_t, 1);
+    o->damage_x = 0;
+    o->damage_y = 0;
+#endif
 
 #if SUPPORT_GFX_FONT
     o->gfxFont = NULL;
 #endif
+#if SUPPORT_DISPLAY_LIST
+    o->record = MP_OBJ_NULL;
+#endif
 
     return MP_OBJ_FROM_PTR(o);
 }
@@ -523,45 +1094,219 @@ STATIC void framebuf_args(const mp_obj_t *args_in, mp_int_t *args_out, int n) {
     }
 }
 
+// Moves a view made before swap() of the frame buffer it's over into the
+// buffer drawn now, views keep no list of themselves for swap() to update
+STATIC mp_obj_framebuf_t *framebuf_follow(mp_obj_framebuf_t *fb) {
+    if (fb->view) {
+        const mp_obj_framebuf_t *top = MP_OBJ_TO_PTR(fb->buf_obj);
+        while (top->view) {
+            top = MP_OBJ_TO_PTR(top->buf_obj);
+        }
+        if (top->buf != fb->top_buf) {
+            fb->buf = (uint8_t *)top->buf + ((uint8_t *)fb->buf - fb->top_buf);
+            fb->top_buf = top->buf;
+        }
+    }
+    return fb;
+}
+
 STATIC mp_int_t framebuf_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags) {
     (void)flags;
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(self_in));
     bufinfo->buf = self->buf;
-    bufinfo->len = self->stride * self->height * (self->format == FRAMEBUF_RGB565 ? 2 : 1);
+    mp_int_t width = panel_width(self), height = panel_height(self);
+    bufinfo->len = self->stride * height * (self->format == FRAMEBUF_RGB565 ? 2 : 1);
+    if (self->view) {
+        // rows of the parent stride, up to the last byte of the view
+        mp_int_t rows = self->format == FRAMEBUF_MVLSB ? (self->yoff + height + 7) / 8 : height;
+        size_t last = self->format == FRAMEBUF_MVLSB ? (size_t)width : ((size_t)(self->xoff + width) * format_bpp[self->format] + 7) / 8;
+        bufinfo->len = rows && width ? (rows - 1) * framebuf_row_bytes(self->format, self->stride) + last : 0;
+    }
     bufinfo->typecode = 'B'; // view framebuf as bytes
     return 0;
 }
 
-STATIC mp_obj_t framebuf_fill(mp_obj_t self_in, mp_obj_t col_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
-    mp_int_t col = mp_obj_get_int(col_in);
-    formats[self->format].fill_rect(self, 0, 0, self->width, self->height, col);
+// view(x, y, w, h) returns a FrameBuffer over a rect of this one, sharing its
+// buffer, so drawing into the view draws straight into this frame buffer
+STATIC mp_obj_t framebuf_view(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
+    mp_int_t args[4]; // x, y, w, h
+    framebuf_args(args_in, args, 4);
+    mp_int_t x = args[0], y = args[1];
+    if (x < 0 || y < 0 || args[2] < 0 || args[3] < 0 || x + args[2] > self->width || y + args[3] > self->height) {
+        mp_raise_ValueError(MP_ERROR_TEXT("view outside the frame buffer"));
+    }
+
+    mp_obj_framebuf_t *o = mp_obj_malloc(mp_obj_framebuf_t, (mp_obj_type_t *)&mp_type_framebuf);
+    *o = *self; // format, stride, tone and damaged region
+    o->base.type = (mp_obj_type_t *)&mp_type_framebuf;
+#if SUPPORT_GFX_FONT
+    o->gfxFont = NULL; // gfx() frees the font it replaces, so each sets its own
+#endif
+    o->buf_obj = MP_OBJ_FROM_PTR(self); // keeps this frame buffer and its buffer alive
+    o->view = true;
+    o->top_buf = self->view ? self->top_buf : self->buf;
+    o->back_obj = MP_OBJ_NULL;
+    o->back = NULL;
+#if SUPPORT_DISPLAY_LIST
+    o->record = MP_OBJ_NULL;
+#endif
+    o->width = args[2];
+    o->height = args[3];
+    clip_reset(o);
+
+    // a view of a rotated frame buffer is rotated alike, over the rect of the buffer it maps to
+    mp_int_t w = args[2], h = args[3];
+    rotate_rect(self, &x, &y, &w, &h);
+    size_t row_bytes = framebuf_row_bytes(self->format, self->stride);
+    if (self->format == FRAMEBUF_MVLSB) {
+        mp_int_t yy = self->yoff + y;
+        o->buf = (uint8_t *)self->buf + (yy >> 3) * row_bytes + x;
+        o->yoff = yy & 7;
+    } else {
+        // sub-byte formats start in the byte holding pixel x, xoff pixels in
+        unsigned int bpp = format_bpp[self->format];
+        size_t bit = (size_t)(self->xoff + x) * bpp;
+        o->buf = (uint8_t *)self->buf + y * row_bytes + bit / 8;
+        o->xoff = bit % 8 / bpp;
+    }
+#if SUPPORT_DAMAGE
+    o->damage_x = self->damage_x + x;
+    o->damage_y = self->damage_y + y;
+#endif
+    return MP_OBJ_FROM_PTR(o);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_view_obj, 5, 5, framebuf_view);
+
+// set_clip(x, y, w, h) restricts drawing to the part of the rect inside the
+// frame buffer, set_clip() lifts the restriction
+STATIC mp_obj_t framebuf_set_clip(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
+    if (n_args == 1) {
+        clip_reset(self);
+        return mp_const_none;
+    }
+    if (n_args != 5) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_int_t args[4]; // x, y, w, h
+    framebuf_args(args_in, args, 4);
+    self->clip_x0 = MIN(MAX(args[0], 0), self->width);
+    self->clip_y0 = MIN(MAX(args[1], 0), self->height);
+    self->clip_x1 = MIN(MAX(args[0] + args[2], self->clip_x0), self->width);
+    self->clip_y1 = MIN(MAX(args[1] + args[3], self->clip_y0), self->height);
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_fill_obj, framebuf_fill);
-
-STATIC mp_obj_t framebuf_fill_rect(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
-    mp_int_t args[5]; // x, y, w, h, col
-    framebuf_args(args_in, args, 5);
-    fill_rect(self, args[0], args[1], args[2], args[3], args[4]);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_set_clip_obj, 1, 5, framebuf_set_clip);
+
+// set_rotation(rotation[, mirror_x, mirror_y]) rotates all drawing clockwise
+// by 0, 90, 180 or 270 degrees, mirrored across the vertical and horizontal
+// axis drawn to, the buffer staying in the order of the display. width and
+// height are exchanged by 90 and 270, and the clip window is lifted.
+STATIC mp_obj_t framebuf_set_rotation(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
+    uint8_t rotate = rotate_flags(mp_obj_get_int(args_in[1]),
+        n_args > 2 && mp_obj_is_true(args_in[2]), n_args > 3 && mp_obj_is_true(args_in[3]));
+
+    if ((rotate ^ self->rotate) & ROTATE_SWAP) {
+        uint16_t t = self->width;
+        self->width = self->height;
+        self->height = t;
+    }
+    self->rotate = rotate;
+    clip_reset(self);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_set_rotation_obj, 2, 4, framebuf_set_rotation);
+
+#if SUPPORT_DAMAGE
+// Copies the bytes of the rect x0, y0 to x1, y1 from the buffer src to dst of the geometry of fb
+STATIC void framebuf_copy_rect(const mp_obj_framebuf_t *fb, uint8_t *dst, const uint8_t *src, const damage_rect_t *r) {
+    size_t row_bytes = framebuf_row_bytes(fb->format, fb->stride);
+    size_t b0, b1, y0, y1;
+    if (fb->format == FRAMEBUF_MVLSB) {
+        b0 = r->x0;
+        b1 = r->x1;
+        y0 = r->y0 / 8;
+        y1 = (r->y1 + 7) / 8;
+    } else {
+        unsigned int bpp = format_bpp[fb->format];
+        b0 = (size_t)r->x0 * bpp / 8;
+        b1 = ((size_t)r->x1 * bpp + 7) / 8;
+        y0 = r->y0;
+        y1 = r->y1;
+    }
+    for (size_t y = y0; y < y1; y++) {
+        memcpy(dst + y * row_bytes + b0, src + y * row_bytes + b0, b1 - b0);
+    }
+}
+#endif
+
+// swap([copy]) exchanges the buffer drawn into with the back buffer given as
+// back=, and returns the buffer drawn so far for the display to show. With
+// copy true, the damaged region is copied into the buffer now drawn into, so
+// that it holds the frame just drawn and drawing can go on from it
+STATIC mp_obj_t framebuf_swap(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    if (self->back == NULL) {
+        mp_raise_ValueError(MP_ERROR_TEXT("no back buffer"));
+    }
+    mp_obj_t front_obj = self->buf_obj;
+    uint8_t *front = self->buf;
+    self->buf_obj = self->back_obj;
+    self->buf = self->back;
+    self->back_obj = front_obj;
+    self->back = front;
+
+    if (n_args > 1 && mp_obj_is_true(args[1])) {
+        #if SUPPORT_DAMAGE
+        for (size_t i = 0; i < self->damage->n; i++) {
+            framebuf_copy_rect(self, self->buf, front, &self->damage->rects[i]);
+        }
+        #else
+        memcpy(self->buf, front, framebuf_size(self));
+        #endif
+    }
+    return front_obj;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_swap_obj, 1, 2, framebuf_swap);
+
+STATIC mp_obj_t framebuf_fill(mp_obj_t self_in, mp_obj_t col_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(self_in));
+    mp_int_t col = mp_obj_get_int(col_in);
+    record_call(self, DL_FILL, 2, (mp_obj_t[]){self_in, col_in}, NULL, MP_OBJ_NULL);
+    fill_rect(self, 0, 0, self->width, self->height, col);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_fill_obj, framebuf_fill);
+
+STATIC mp_obj_t framebuf_fill_rect(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
+    mp_int_t args[5]; // x, y, w, h, col
+    framebuf_args(args_in, args, 5);
+    record_call(self, DL_FILL_RECT, n_args, args_in, NULL, MP_OBJ_NULL);
+    fill_rect(self, args[0], args[1], args[2], args[3], args[4]);
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_fill_rect_obj, 6, 6, framebuf_fill_rect);
 
 STATIC mp_obj_t framebuf_pixel(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t x = mp_obj_get_int(args_in[1]);
     mp_int_t y = mp_obj_get_int(args_in[2]);
     if (0 <= x && x < self->width && 0 <= y && y < self->height) {
         if (n_args == 3) {
             // get
             return MP_OBJ_NEW_SMALL_INT(getpixel(self, x, y));
-        } else {
+        } else if (clip_contains(self, x, y)) {
             // set
             setpixel(self, x, y, mp_obj_get_int(args_in[3]));
+            damage_add(self, x, y, 1, 1);
         }
     }
+    if (n_args > 3) {
+        record_call(self, DL_PIXEL, n_args, args_in, NULL, MP_OBJ_NULL);
+    }
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_pixel_obj, 3, 4, framebuf_pixel);
@@ -569,9 +1314,10 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_pixel_obj, 3, 4, framebuf_pi
 STATIC mp_obj_t framebuf_hline(size_t n_args, const mp_obj_t *args_in) {
     (void)n_args;
 
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[4]; // x, y, w, col
     framebuf_args(args_in, args, 4);
+    record_call(self, DL_HLINE, n_args, args_in, NULL, MP_OBJ_NULL);
 
     fill_rect(self, args[0], args[1], args[2], 1, args[3]);
 
@@ -582,9 +1328,10 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_hline_obj, 5, 5, framebuf_hl
 STATIC mp_obj_t framebuf_vline(size_t n_args, const mp_obj_t *args_in) {
     (void)n_args;
 
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[4]; // x, y, h, col
     framebuf_args(args_in, args, 4);
+    record_call(self, DL_VLINE, n_args, args_in, NULL, MP_OBJ_NULL);
 
     fill_rect(self, args[0], args[1], 1, args[2], args[3]);
 
@@ -593,9 +1340,10 @@ STATIC mp_obj_t framebuf_vline(size_t n_args, const mp_obj_t *args_in) {
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_vline_obj, 5, 5, framebuf_vline);
 
 STATIC mp_obj_t framebuf_rect(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[5]; // x, y, w, h, col
     framebuf_args(args_in, args, 5);
+    record_call(self, DL_RECT, n_args, args_in, NULL, MP_OBJ_NULL);
     if (n_args > 6 && mp_obj_is_true(args_in[6])) {
         fill_rect(self, args[0], args[1], args[2], args[3], args[4]);
     } else {
@@ -626,6 +1374,10 @@ STATIC void line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t
         dy = -dy;
         sy = -1;
     }
+    if (MAX(x1, x2) < fb->clip_x0 || MIN(x1, x2) >= fb->clip_x1 || MAX(y1, y2) < fb->clip_y0 || MIN(y1, y2) >= fb->clip_y1) {
+        return;
+    }
+    damage_add(fb, MIN(x1, x2), MIN(y1, y2), dx + 1, dy + 1);
 
     bool steep;
     if (dy > dx) {
@@ -647,11 +1399,11 @@ STATIC void line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t
     mp_int_t e = 2 * dy - dx;
     for (mp_int_t i = 0; i < dx; ++i) {
         if (steep) {
-            if (0 <= y1 && y1 < fb->width && 0 <= x1 && x1 < fb->height) {
+            if (clip_contains(fb, y1, x1)) {
                 setpixel(fb, y1, x1, col);
             }
         } else {
-            if (0 <= x1 && x1 < fb->width && 0 <= y1 && y1 < fb->height) {
+            if (clip_contains(fb, x1, y1)) {
                 setpixel(fb, x1, y1, col);
             }
         }
@@ -663,7 +1415,7 @@ STATIC void line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t
         e += 2 * dy;
     }
 
-    if (0 <= x2 && x2 < fb->width && 0 <= y2 && y2 < fb->height) {
+    if (clip_contains(fb, x2, y2)) {
         setpixel(fb, x2, y2, col);
     }
 }
@@ -671,9 +1423,10 @@ STATIC void line(const mp_obj_framebuf_t *fb, mp_int_t x1, mp_int_t y1, mp_int_t
 STATIC mp_obj_t framebuf_line(size_t n_args, const mp_obj_t *args_in) {
     (void)n_args;
 
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[5]; // x1, y1, x2, y2, col
     framebuf_args(args_in, args, 5);
+    record_call(self, DL_LINE, n_args, args_in, NULL, MP_OBJ_NULL);
 
     line(self, args[0], args[1], args[2], args[3], args[4]);
 
@@ -713,7 +1466,7 @@ STATIC void draw_ellipse_points(const mp_obj_framebuf_t *fb, mp_int_t cx, mp_int
 }
 
 STATIC mp_obj_t framebuf_ellipse(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_int_t args[5];
     framebuf_args(args_in, args, 5); // cx, cy, xradius, yradius, col
     mp_int_t mask = (n_args > 6 && mp_obj_is_true(args_in[6])) ? ELLIPSE_MASK_FILL : 0;
@@ -722,6 +1475,7 @@ STATIC mp_obj_t framebuf_ellipse(size_t n_args, const mp_obj_t *args_in) {
     } else {
         mask |= ELLIPSE_MASK_ALL;
     }
+    record_call(self, DL_ELLIPSE, n_args, args_in, NULL, MP_OBJ_NULL);
     mp_int_t two_asquare = 2 * args[2] * args[2];
     mp_int_t two_bsquare = 2 * args[3] * args[3];
     mp_int_t x = args[2];
@@ -778,7 +1532,7 @@ STATIC mp_int_t poly_int(mp_buffer_info_t *bufinfo, size_t index) {
 }
 
 STATIC mp_obj_t framebuf_poly(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
 
     mp_int_t x = mp_obj_get_int(args_in[1]);
     mp_int_t y = mp_obj_get_int(args_in[2]);
@@ -794,6 +1548,7 @@ STATIC mp_obj_t framebuf_poly(size_t n_args, const mp_obj_t *args_in) {
 
     mp_int_t col = mp_obj_get_int(args_in[4]);
     bool fill = n_args > 5 && mp_obj_is_true(args_in[5]);
+    record_call(self, DL_POLY, n_args, args_in, NULL, MP_OBJ_NULL);
 
     if (fill) {
         // This implements an integer version of http://alienryderflex.com/polygon_fill/
@@ -890,42 +1645,241 @@ STATIC mp_obj_t framebuf_poly(size_t n_args, const mp_obj_t *args_in) {
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_poly_obj, 5, 6, framebuf_poly);
 #endif // MICROPY_PY_ARRAY && !MICROPY_ENABLE_DYNRUNTIME
 
-STATIC mp_obj_t framebuf_blit(size_t n_args, const mp_obj_t *args_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
-    mp_obj_t source_in = mp_obj_cast_to_native_base(args_in[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+// flip of blit(), the source is mirrored before it's rotated
+#define FLIP_X (1)
+#define FLIP_Y (2)
+
+#define BLIT_BLOCK (8) // pixels of a side of the blocks of a rotated blit()
+
+// Masks of the low g bits of each 2 * g bits
+STATIC const uint32_t block_masks[17] = {
+    [1] = 0x55555555, [2] = 0x33333333, [4] = 0x0f0f0f0f, [8] = 0x00ff00ff, [16] = 0x0000ffff,
+};
+
+// An 8x8 block of a packed format is held in 8 rows, pixel c of row r in
+// the bits c * bpp of rows[r]. The mono and GS4 formats are moved a block at a time.
+STATIC bool block_format(uint8_t format) {
+    return format == FRAMEBUF_MVLSB || format == FRAMEBUF_MHLSB || format == FRAMEBUF_MHMSB
+           || format == FRAMEBUF_GS4_HMSB || format == FRAMEBUF_GS4_HLSB;
+}
+
+// Reverses the order of the pixels of bpp bits within each g * 2 bits of w
+static inline uint32_t block_reverse(uint32_t w, unsigned int g, unsigned int bpp) {
+    for (; g >= bpp; g >>= 1) {
+        w = ((w >> g) & block_masks[g]) | ((w & block_masks[g]) << g);
+    }
+    return w;
+}
+
+// Transposes a block in place, a bit-matrix transpose exchanging the
+// off-diagonal quarters of the 8x8, 4x4 and then 2x2 sub-blocks
+STATIC void block_transpose(uint32_t *rows, unsigned int bpp) {
+    for (unsigned int n = 4; n > 0; n >>= 1) {
+        unsigned int g = n * bpp;
+        for (unsigned int r = 0; r < 8; r++) {
+            if (!(r & n)) {
+                uint32_t t = ((rows[r] >> g) ^ rows[r + n]) & block_masks[g];
+                rows[r] ^= t << g;
+                rows[r + n] ^= t;
+            }
+        }
+    }
+}
+
+// Whether the first pixel of a byte is in its high bits
+static inline bool block_msb_first(uint8_t format) {
+    return format == FRAMEBUF_MHLSB || format == FRAMEBUF_GS4_HMSB;
+}
+
+// Whether the block at x, y of fb starts on a byte, or on a page for MVLSB
+static inline bool block_aligned(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y) {
+    if (fb->format == FRAMEBUF_MVLSB) {
+        return (y + fb->yoff) % 8 == 0;
+    }
+    return (x + fb->xoff) * format_bpp[fb->format] % 8 == 0;
+}
+
+// Reads the aligned block at x, y of the buffer of fb, the columns of an
+// MVLSB page are transposed into rows
+STATIC void block_load(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y, uint32_t *rows) {
+    size_t row_bytes = framebuf_row_bytes(fb->format, fb->stride);
+    unsigned int bpp = format_bpp[fb->format];
+    if (fb->format == FRAMEBUF_MVLSB) {
+        const uint8_t *p = (const uint8_t *)fb->buf + (y + fb->yoff) / 8 * row_bytes + x;
+        for (unsigned int c = 0; c < 8; c++) {
+            rows[c] = p[c];
+        }
+        block_transpose(rows, 1);
+        return;
+    }
+    const uint8_t *p = (const uint8_t *)fb->buf + y * row_bytes + (x + fb->xoff) * bpp / 8;
+    for (unsigned int r = 0; r < 8; r++, p += row_bytes) {
+        uint32_t w = 0;
+        for (unsigned int b = 0; b < bpp; b++) {
+            w |= (uint32_t)p[b] << (8 * b);
+        }
+        rows[r] = block_msb_first(fb->format) ? block_reverse(w, 4, bpp) : w;
+    }
+}
+
+// Writes a block to the aligned block at x, y of the buffer of fb
+STATIC void block_store(const mp_obj_framebuf_t *fb, mp_int_t x, mp_int_t y, uint32_t *rows) {
+    size_t row_bytes = framebuf_row_bytes(fb->format, fb->stride);
+    unsigned int bpp = format_bpp[fb->format];
+    if (fb->format == FRAMEBUF_MVLSB) {
+        uint8_t *p = (uint8_t *)fb->buf + (y + fb->yoff) / 8 * row_bytes + x;
+        block_transpose(rows, 1);
+        for (unsigned int c = 0; c < 8; c++) {
+            p[c] = rows[c];
+        }
+        return;
+    }
+    uint8_t *p = (uint8_t *)fb->buf + y * row_bytes + (x + fb->xoff) * bpp / 8;
+    for (unsigned int r = 0; r < 8; r++, p += row_bytes) {
+        uint32_t w = block_msb_first(fb->format) ? block_reverse(rows[r], 4, bpp) : rows[r];
+        for (unsigned int b = 0; b < bpp; b++) {
+            p[b] = w >> (8 * b);
+        }
+    }
+}
+
+// Draws source at x, y rotated and flipped by the ROTATE_* flags rotate, an
+// 8x8 block of the source at a time so the rows read and the columns written
+// stay in cache. Blocks of the mono and GS4 formats that start on a byte in
+// both buffers are moved with bit-matrix transposes, the others a pixel at a time.
+STATIC void blit_rotated(const mp_obj_framebuf_t *self, const mp_obj_framebuf_t *source, mp_int_t x, mp_int_t y,
+    uint8_t rotate, mp_int_t key, const mp_obj_framebuf_t *palette) {
+    bool swap = rotate & ROTATE_SWAP;
+    mp_int_t dw = swap ? source->height : source->width;
+    mp_int_t dh = swap ? source->width : source->height;
+    mp_int_t x0 = MAX(self->clip_x0, x);
+    mp_int_t y0 = MAX(self->clip_y0, y);
+    mp_int_t w = MIN(self->clip_x1, x + dw) - x0;
+    mp_int_t h = MIN(self->clip_y1, y + dh) - y0;
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    damage_add(self, x0, y0, w, h);
+
+    // the rect of the source drawn, mirrored back and exchanged back
+    mp_int_t u = x0 - x, v = y0 - y;
+    if (rotate & ROTATE_FLIP_X) {
+        u = dw - u - w;
+    }
+    if (rotate & ROTATE_FLIP_Y) {
+        v = dh - v - h;
+    }
+    mp_int_t i0 = swap ? v : u, j0 = swap ? u : v;
+    mp_int_t i1 = i0 + (swap ? h : w), j1 = j0 + (swap ? w : h);
+
+    bool fast = source->format == self->format && block_format(self->format)
+        && key == -1 && palette == NULL && !self->rotate && !source->rotate;
+    unsigned int bpp = format_bpp[self->format];
+
+    // blocks start on the bytes (pages for MVLSB) of the source
+    for (mp_int_t bj = j0 - (j0 + source->yoff) % BLIT_BLOCK; bj < j1; bj += BLIT_BLOCK) {
+        for (mp_int_t bi = i0 - (i0 + source->xoff) % BLIT_BLOCK; bi < i1; bi += BLIT_BLOCK) {
+            mp_int_t bx = bi, by = bj, bw = BLIT_BLOCK, bh = BLIT_BLOCK;
+            transform_rect(rotate, dw, dh, &bx, &by, &bw, &bh);
+            bx += x;
+            by += y;
+            if (fast && i0 <= bi && bi + BLIT_BLOCK <= i1 && j0 <= bj && bj + BLIT_BLOCK <= j1 && block_aligned(self, bx, by)) {
+                uint32_t rows[8];
+                block_load(source, bi, bj, rows);
+                if (swap) {
+                    block_transpose(rows, bpp);
+                }
+                for (unsigned int r = 0; (rotate & ROTATE_FLIP_X) && r < 8; r++) {
+                    rows[r] = block_reverse(rows[r], 4 * bpp, bpp);
+                }
+                for (unsigned int r = 0; (rotate & ROTATE_FLIP_Y) && r < 4; r++) {
+                    uint32_t t = rows[r];
+                    rows[r] = rows[7 - r];
+                    rows[7 - r] = t;
+                }
+                block_store(self, bx, by, rows);
+                continue;
+            }
+
+            for (mp_int_t j = MAX(bj, j0); j < MIN(bj + BLIT_BLOCK, j1); j++) {
+                for (mp_int_t i = MAX(bi, i0); i < MIN(bi + BLIT_BLOCK, i1); i++) {
+                    uint32_t col = getpixel(source, i, j);
+                    if (palette) {
+                        col = getpixel(palette, col, 0);
+                    }
+                    if (col == (uint32_t)key) {
+                        continue;
+                    }
+                    mp_int_t px = swap ? j : i, py = swap ? i : j;
+                    if (rotate & ROTATE_FLIP_X) {
+                        px = dw - 1 - px;
+                    }
+                    if (rotate & ROTATE_FLIP_Y) {
+                        py = dh - 1 - py;
+                    }
+                    setpixel(self, x + px, y + py, col);
+                }
+            }
+        }
+    }
+}
+
+// blit(src, x, y[, key, palette, rotate, flip]) draws src at x, y, with
+// rotate 90, 180 or 270 rotated clockwise, and flip FLIP_X and FLIP_Y
+// mirrored across its vertical and horizontal axis before that
+STATIC mp_obj_t framebuf_blit(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_src, ARG_x, ARG_y, ARG_key, ARG_palette, ARG_rotate, ARG_flip };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_src, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_x, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_y, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_key, MP_ARG_INT, {.u_int = -1} },
+        { MP_QSTR_palette, MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_rotate, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_flip, MP_ARG_INT, {.u_int = 0} },
+    };
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(pos_args[0]));
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[ARG_src].u_obj, MP_OBJ_FROM_PTR(&mp_type_framebuf));
     if (source_in == MP_OBJ_NULL) {
         mp_raise_TypeError(NULL);
     }
-    mp_obj_framebuf_t *source = MP_OBJ_TO_PTR(source_in);
+    mp_obj_framebuf_t *source = framebuf_follow(MP_OBJ_TO_PTR(source_in));
 
-    mp_int_t x = mp_obj_get_int(args_in[2]);
-    mp_int_t y = mp_obj_get_int(args_in[3]);
-    mp_int_t key = -1;
-    if (n_args > 4) {
-        key = mp_obj_get_int(args_in[4]);
-    }
+    mp_int_t x = args[ARG_x].u_int;
+    mp_int_t y = args[ARG_y].u_int;
+    mp_int_t key = args[ARG_key].u_int;
     mp_obj_framebuf_t *palette = NULL;
-    if (n_args > 5 && args_in[5] != mp_const_none) {
-        palette = MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args_in[5], MP_OBJ_FROM_PTR(&mp_type_framebuf)));
+    if (args[ARG_palette].u_obj != mp_const_none) {
+        palette = framebuf_follow(MP_OBJ_TO_PTR(mp_obj_cast_to_native_base(args[ARG_palette].u_obj, MP_OBJ_FROM_PTR(&mp_type_framebuf))));
+    }
+    mp_int_t flip = args[ARG_flip].u_int;
+    uint8_t rotate = rotate_flags(args[ARG_rotate].u_int, flip & FLIP_X, flip & FLIP_Y);
+    record_call(self, DL_BLIT, n_args, pos_args, kw_args, MP_OBJ_NULL);
+    if (rotate) {
+        blit_rotated(self, source, x, y, rotate, key, palette);
+        return mp_const_none;
     }
 
     if (
-        (x >= self->width) ||
-        (y >= self->height) ||
-        (-x >= source->width) ||
-        (-y >= source->height)
+        (x >= self->clip_x1) ||
+        (y >= self->clip_y1) ||
+        (self->clip_x0 - x >= source->width) ||
+        (self->clip_y0 - y >= source->height)
         ) {
         // Out of bounds, no-op.
         return mp_const_none;
     }
 
     // Clip.
-    int x0 = MAX(0, x);
-    int y0 = MAX(0, y);
-    int x1 = MAX(0, -x);
-    int y1 = MAX(0, -y);
-    int x0end = MIN(self->width, x + source->width);
-    int y0end = MIN(self->height, y + source->height);
+    int x0 = MAX(self->clip_x0, x);
+    int y0 = MAX(self->clip_y0, y);
+    int x1 = x0 - x;
+    int y1 = y0 - y;
+    int x0end = MIN(self->clip_x1, x + source->width);
+    int y0end = MIN(self->clip_y1, y + source->height);
+    damage_add(self, x0, y0, x0end - x0, y0end - y0);
 
     for (; y0 < y0end; ++y0) {
         int cx1 = x1;
@@ -943,43 +1897,326 @@ STATIC mp_obj_t framebuf_blit(size_t n_args, const mp_obj_t *args_in) {
     }
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_blit_obj, 4, 6, framebuf_blit);
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(framebuf_blit_obj, 4, framebuf_blit);
+
+#define SCALE_NEAREST  (0)
+#define SCALE_BILINEAR (1)
+#define SCALE_AREA     (2)
+
+// Splits a colour of format into its channels, one for the gray and mono
+// formats, and returns their number
+STATIC unsigned int scale_unpack(uint8_t format, uint32_t col, uint32_t *ch) {
+    switch (format) {
+        case FRAMEBUF_RGB565:
+            ch[0] = (col >> 11) & 0x1f;
+            ch[1] = (col >> 5) & 0x3f;
+            ch[2] = col & 0x1f;
+            return 3;
+        case FRAMEBUF_RGB888:
+            ch[0] = (col >> 16) & 0xff;
+            ch[1] = (col >> 8) & 0xff;
+            ch[2] = col & 0xff;
+            return 3;
+        default:
+            ch[0] = col;
+            return 1;
+    }
+}
+
+STATIC uint32_t scale_pack(uint8_t format, const uint32_t *ch) {
+    switch (format) {
+        case FRAMEBUF_RGB565:
+            return ch[0] << 11 | ch[1] << 5 | ch[2];
+        case FRAMEBUF_RGB888:
+            return ch[0] << 16 | ch[1] << 8 | ch[2];
+        default:
+            return ch[0];
+    }
+}
+
+// Source position in 16.16 fixed point under the centre of a dest pixel at
+// pos, less half a pixel for bilinear to put the source pixels at their centres
+static inline uint32_t scale_bilinear_pos(uint32_t pos) {
+    return pos < 0x8000 ? 0 : pos - 0x8000;
+}
+
+// blit_scaled(src, x, y, w, h[, filter]) draws src stretched to w x h at x, y,
+// with filter SCALE_NEAREST, SCALE_BILINEAR or SCALE_AREA. The source column
+// of each dest column is stepped in 16.16 fixed point once, for all rows
+STATIC mp_obj_t framebuf_blit_scaled(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_src, ARG_x, ARG_y, ARG_w, ARG_h, ARG_filter };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_src, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_x, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_y, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_w, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_h, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_filter, MP_ARG_INT, {.u_int = SCALE_NEAREST} },
+    };
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(pos_args[0]));
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[ARG_src].u_obj, MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = framebuf_follow(MP_OBJ_TO_PTR(source_in));
+    mp_int_t x = args[ARG_x].u_int;
+    mp_int_t y = args[ARG_y].u_int;
+    mp_int_t w = args[ARG_w].u_int;
+    mp_int_t h = args[ARG_h].u_int;
+    mp_int_t filter = args[ARG_filter].u_int;
+    if (filter < SCALE_NEAREST || filter > SCALE_AREA) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid filter"));
+    }
+    bool mono = source->format == FRAMEBUF_MVLSB || source->format == FRAMEBUF_MHLSB || source->format == FRAMEBUF_MHMSB;
+    if (filter == SCALE_BILINEAR && mono) {
+        mp_raise_ValueError(MP_ERROR_TEXT("bilinear needs a gray or colour source"));
+    }
+    record_call(self, DL_BLIT_SCALED, n_args, pos_args, kw_args, MP_OBJ_NULL);
+
+    if (w < 1 || h < 1 || source->width == 0 || source->height == 0 ||
+        x >= self->clip_x1 || y >= self->clip_y1 || x + w <= self->clip_x0 || y + h <= self->clip_y0) {
+        // Out of bounds, no-op.
+        return mp_const_none;
+    }
+
+    // dest columns u0 to u1 and rows v0 to v1 of the w x h rect are in the clip window
+    mp_int_t u0 = MAX(self->clip_x0, x) - x;
+    mp_int_t v0 = MAX(self->clip_y0, y) - y;
+    mp_int_t u1 = MIN(self->clip_x1, x + w) - x;
+    mp_int_t v1 = MIN(self->clip_y1, y + h) - y;
+    damage_add(self, x + u0, y + v0, u1 - u0, v1 - v0);
+
+    mp_int_t sw = source->width;
+    mp_int_t sh = source->height;
+    uint32_t step_x = ((uint32_t)sw << 16) / w;
+    uint32_t step_y = ((uint32_t)sh << 16) / h;
+    bool bilinear = filter == SCALE_BILINEAR;
+
+    // The source column of each dest column, with its weight in the low 8 bits
+    // for bilinear. For area the first column of its box, then the end of the
+    // last box, divided exactly as a box a column short changes the mean
+    mp_int_t n = u1 - u0;
+    uint32_t *cols = m_new(uint32_t, n + 1);
+    uint32_t pos = u0 * step_x + step_x / 2;
+    for (mp_int_t i = 0; i <= n; i++, pos += step_x) {
+        if (filter == SCALE_AREA) {
+            cols[i] = (uint64_t)(u0 + i) * sw / w;
+        } else if (bilinear) {
+            uint32_t p = scale_bilinear_pos(pos);
+            cols[i] = MIN(p >> 16, (uint32_t)sw - 1) << 8 | ((p >> 8) & 0xff);
+        } else {
+            cols[i] = MIN(pos >> 16, (uint32_t)sw - 1);
+        }
+    }
+
+    uint8_t format = source->format;
+    uint32_t a[3], b[3], c[3], d[3], px[3];
+    if (filter == SCALE_NEAREST) {
+        pos = v0 * step_y + step_y / 2;
+        for (mp_int_t j = v0; j < v1;) {
+            // dest rows of the same source row are filled as one band
+            uint32_t sy = pos >> 16;
+            mp_int_t jend = j + 1;
+            for (pos += step_y; jend < v1 && pos >> 16 == sy; pos += step_y) {
+                jend++;
+            }
+            for (mp_int_t i = 0; i < n;) {
+                uint32_t col = getpixel(source, cols[i], sy);
+                mp_int_t iend = i + 1;
+                while (iend < n && (cols[iend] == cols[iend - 1] || getpixel(source, cols[iend], sy) == col)) {
+                    iend++;
+                }
+                fill_rect_inside(self, x + u0 + i, y + j, iend - i, jend - j, col);
+                i = iend;
+            }
+            j = jend;
+        }
+    } else if (bilinear) {
+        pos = v0 * step_y + step_y / 2;
+        for (mp_int_t j = v0; j < v1; j++, pos += step_y) {
+            uint32_t p = scale_bilinear_pos(pos);
+            uint32_t sy0 = MIN(p >> 16, (uint32_t)sh - 1);
+            uint32_t sy1 = MIN(sy0 + 1, (uint32_t)sh - 1);
+            uint32_t wy = (p >> 8) & 0xff;
+            uint32_t last = UINT32_MAX;
+            unsigned int nch = 1;
+            for (mp_int_t i = 0; i < n; i++) {
+                uint32_t sx0 = cols[i] >> 8;
+                uint32_t wx = cols[i] & 0xff;
+                if (sx0 != last) {
+                    // the four source pixels are shared by the dest pixels between them
+                    uint32_t sx1 = MIN(sx0 + 1, (uint32_t)sw - 1);
+                    nch = scale_unpack(format, getpixel(source, sx0, sy0), a);
+                    scale_unpack(format, getpixel(source, sx1, sy0), b);
+                    scale_unpack(format, getpixel(source, sx0, sy1), c);
+                    scale_unpack(format, getpixel(source, sx1, sy1), d);
+                    last = sx0;
+                }
+                for (unsigned int k = 0; k < nch; k++) {
+                    uint32_t top = a[k] * (256 - wx) + b[k] * wx;
+                    uint32_t bottom = c[k] * (256 - wx) + d[k] * wx;
+                    px[k] = (top * (256 - wy) + bottom * wy + 0x8000) >> 16;
+                }
+                setpixel(self, x + u0 + i, y + j, scale_pack(format, px));
+            }
+        }
+    } else {
+        // the mean of the box of source pixels under each dest pixel
+        for (mp_int_t j = v0; j < v1; j++) {
+            uint32_t sy0 = (uint64_t)j * sh / h;
+            uint32_t sy1 = MAX((uint64_t)(j + 1) * sh / h, sy0 + 1);
+            for (mp_int_t i = 0; i < n; i++) {
+                uint32_t sx0 = cols[i];
+                uint32_t sx1 = MAX(cols[i + 1], sx0 + 1);
+                uint32_t sum[3] = { 0, 0, 0 };
+                unsigned int nch = 1;
+                for (uint32_t sy = sy0; sy < sy1; sy++) {
+                    for (uint32_t sx = sx0; sx < sx1; sx++) {
+                        nch = scale_unpack(format, getpixel(source, sx, sy), px);
+                        for (unsigned int k = 0; k < nch; k++) {
+                            sum[k] += px[k];
+                        }
+                    }
+                }
+                uint32_t area = (sy1 - sy0) * (sx1 - sx0);
+                for (unsigned int k = 0; k < nch; k++) {
+                    px[k] = (sum[k] + area / 2) / area;
+                }
+                setpixel(self, x + u0 + i, y + j, scale_pack(format, px));
+            }
+        }
+    }
+    m_del(uint32_t, cols, n + 1);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(framebuf_blit_scaled_obj, 6, framebuf_blit_scaled);
+
+#if SUPPORT_DITHER
+// convert_from(src[, x, y], *, dither) draws the frame buffer src at x, y,
+// converting its pixels to the format of this one
+STATIC mp_obj_t framebuf_convert_from(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_src, ARG_x, ARG_y, ARG_dither };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_src, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_x, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_y, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_dither, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = DITHER_NONE} },
+    };
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(pos_args[0]));
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    mp_obj_t source_in = mp_obj_cast_to_native_base(args[ARG_src].u_obj, MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (source_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *source = framebuf_follow(MP_OBJ_TO_PTR(source_in));
+    mp_int_t x = args[ARG_x].u_int;
+    mp_int_t y = args[ARG_y].u_int;
+    uint8_t mode = dither_mode(args[ARG_dither].u_int);
+    record_call(self, DL_CONVERT_FROM, n_args, pos_args, kw_args, MP_OBJ_NULL);
+
+    // clip as blit does
+    mp_int_t x0 = MAX(self->clip_x0, x);
+    mp_int_t y0 = MAX(self->clip_y0, y);
+    mp_int_t x1 = x0 - x;
+    mp_int_t y1 = y0 - y;
+    mp_int_t w = MIN(self->clip_x1, x + source->width) - x0;
+    mp_int_t h = MIN(self->clip_y1, y + source->height) - y0;
+    if (w <= 0 || h <= 0) {
+        return mp_const_none;
+    }
+    damage_add(self, x0, y0, w, h);
+
+    dither_t d;
+    dither_init(&d, mode, self->format, w);
+    uint8_t *gray = d.mode != DITHER_NONE ? m_new(uint8_t, w) : NULL;
+    uint8_t rgb[3];
+
+    for (mp_int_t j = 0; j < h; j++) {
+        for (mp_int_t i = 0; i < w; i++) {
+            native_to_rgb888(source->format, getpixel(source, x1 + i, y1 + j), rgb);
+            if (gray != NULL) {
+                gray[i] = rgb888_to_gray(self, rgb[0], rgb[1], rgb[2]);
+            } else {
+                setpixel(self, x0 + i, y0 + j, img_color(self, rgb[0], rgb[1], rgb[2]));
+            }
+        }
+        if (gray != NULL) {
+            dither_row(&d, gray, self, x0, y0 + j);
+        }
+    }
+
+    if (gray != NULL) {
+        m_del(uint8_t, gray, w);
+    }
+    dither_deinit(&d);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(framebuf_convert_from_obj, 2, framebuf_convert_from);
+#endif
+
+#if SUPPORT_IMG_IO || SUPPORT_DITHER
+// tone([curve]) sets the 256 byte curve mapping the luma of colours drawn on
+// gray and mono formats to gray levels, or the linear one if curve is None
+STATIC mp_obj_t framebuf_tone(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    if (n_args == 1 || args[1] == mp_const_none) {
+        self->tone = NULL;
+        return mp_const_none;
+    }
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[1], &bufinfo, MP_BUFFER_READ);
+    if (bufinfo.len != 256) {
+        mp_raise_ValueError(MP_ERROR_TEXT("tone curve must have 256 entries"));
+    }
+    // a copy, so a curve changed later gives a new key to the image cache
+    uint8_t *tone = m_new(uint8_t, 256);
+    memcpy(tone, bufinfo.buf, 256);
+    self->tone = tone;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_tone_obj, 1, 2, framebuf_tone);
+#endif
 
 STATIC mp_obj_t framebuf_scroll(mp_obj_t self_in, mp_obj_t xstep_in, mp_obj_t ystep_in) {
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(self_in));
     mp_int_t xstep = mp_obj_get_int(xstep_in);
     mp_int_t ystep = mp_obj_get_int(ystep_in);
+    // the pixels of the clip window move within it
     int sx, y, xend, yend, dx, dy;
     if (xstep < 0) {
-        sx = 0;
-        xend = self->width + xstep;
-        if (xend <= 0) {
+        sx = self->clip_x0;
+        xend = self->clip_x1 + xstep;
+        if (xend <= sx) {
             return mp_const_none;
         }
         dx = 1;
     } else {
-        sx = self->width - 1;
-        xend = xstep - 1;
+        sx = self->clip_x1 - 1;
+        xend = self->clip_x0 + xstep - 1;
         if (xend >= sx) {
             return mp_const_none;
         }
         dx = -1;
     }
     if (ystep < 0) {
-        y = 0;
-        yend = self->height + ystep;
-        if (yend <= 0) {
+        y = self->clip_y0;
+        yend = self->clip_y1 + ystep;
+        if (yend <= y) {
             return mp_const_none;
         }
         dy = 1;
     } else {
-        y = self->height - 1;
-        yend = ystep - 1;
+        y = self->clip_y1 - 1;
+        yend = self->clip_y0 + ystep - 1;
         if (yend >= y) {
             return mp_const_none;
         }
         dy = -1;
     }
+    damage_add(self, self->clip_x0, self->clip_y0, self->clip_x1 - self->clip_x0, self->clip_y1 - self->clip_y0);
     for (; y != yend; y += dy) {
         for (int x = sx; x != xend; x += dx) {
             setpixel(self, x, y, getpixel(self, x - xstep, y - ystep));
@@ -991,7 +2228,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_3(framebuf_scroll_obj, framebuf_scroll);
 
 STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args_in) {
     // extract arguments
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     const char *str = mp_obj_str_get_str(args_in[1]);
     mp_int_t x0 = mp_obj_get_int(args_in[2]);
     mp_int_t y0 = mp_obj_get_int(args_in[3]);
@@ -999,6 +2236,8 @@ STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args_in) {
     if (n_args >= 5) {
         col = mp_obj_get_int(args_in[4]);
     }
+    record_call(self, DL_TEXT, n_args, args_in, NULL, MP_OBJ_NULL);
+    damage_add(self, x0, y0, 8 * strlen(str), 8);
 
     // loop over chars
     for (; *str; ++str) {
@@ -1011,11 +2250,11 @@ STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args_in) {
         const uint8_t *chr_data = &font_petme128_8x8[(chr - 32) * 8];
         // loop over char data
         for (int j = 0; j < 8; j++, x0++) {
-            if (0 <= x0 && x0 < self->width) { // clip x
+            if (self->clip_x0 <= x0 && x0 < self->clip_x1) { // clip x
                 uint vline_data = chr_data[j]; // each byte is a column of 8 pixels, LSB at top
                 for (int y = y0; vline_data; vline_data >>= 1, y++) { // scan over vertical column
                     if (vline_data & 1) { // only draw if pixel set
-                        if (0 <= y && y < self->height) { // clip y
+                        if (self->clip_y0 <= y && y < self->clip_y1) { // clip y
                             setpixel(self, x0, y, col);
                         }
                     }
@@ -1027,11 +2266,360 @@ STATIC mp_obj_t framebuf_text(size_t n_args, const mp_obj_t *args_in) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_text_obj, 4, 5, framebuf_text);
 
+#if SUPPORT_DAMAGE
+// damage() returns the damaged region as a list of (x, y, w, h) rects,
+// damage(x, y, w, h) adds a rect, e.g. after writing to the buffer directly
+STATIC mp_obj_t framebuf_damage(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
+    if (n_args == 5) {
+        mp_int_t args[4]; // x, y, w, h
+        framebuf_args(args_in, args, 4);
+        damage_add(self, args[0], args[1], args[2], args[3]);
+        return mp_const_none;
+    }
+    if (n_args != 1) {
+        mp_raise_TypeError(NULL);
+    }
+
+    const framebuf_damage_t *dmg = self->damage;
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+    for (unsigned int i = 0; i < dmg->n; i++) {
+        const damage_rect_t *r = &dmg->rects[i];
+        mp_obj_t value[4];
+        value[0] = MP_OBJ_NEW_SMALL_INT(r->x0);
+        value[1] = MP_OBJ_NEW_SMALL_INT(r->y0);
+        value[2] = MP_OBJ_NEW_SMALL_INT(r->x1 - r->x0);
+        value[3] = MP_OBJ_NEW_SMALL_INT(r->y1 - r->y0);
+        mp_obj_list_append(list, mp_obj_new_tuple(4, value));
+    }
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_damage_obj, 1, 5, framebuf_damage);
+
+// clear_damage() empties the damaged region, once the display is updated
+STATIC mp_obj_t framebuf_clear_damage(mp_obj_t self_in) {
+    damage_clear(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(framebuf_clear_damage_obj, framebuf_clear_damage);
+
+// Where the tiles of a frame buffer are in its buffer. Memory rows are
+// pixel rows, or 8-row pages for MVLSB. Tiles are a multiple of 8 pixels
+// wide so that they start on a byte, and of 8 pixels high for MVLSB.
+typedef struct {
+    mp_int_t ntx, nty;  // tiles across and down
+    mp_int_t rows;      // memory rows
+    mp_int_t band;      // memory rows per row of tiles
+    size_t row_bytes;   // bytes from a memory row to the next
+    size_t tile_bytes;  // bytes of a tile in a memory row
+    size_t bytes;       // bytes of a memory row up to the last pixel
+} tile_layout_t;
+
+// Tiles are compared and hashed in bytes, so a view's first pixel must start one
+STATIC void tile_check_view(const mp_obj_framebuf_t *fb) {
+    if (fb->xoff || fb->yoff) {
+        mp_raise_ValueError(MP_ERROR_TEXT("view must start on a byte"));
+    }
+}
+
+STATIC void tile_layout(tile_layout_t *tl, const mp_obj_framebuf_t *fb, mp_int_t tile_w, mp_int_t tile_h) {
+    mp_int_t page = fb->format == FRAMEBUF_MVLSB ? 8 : 1;
+    tile_check_view(fb);
+    if (tile_w < 8 || tile_w % 8 != 0 || tile_w > 0xffff || tile_h < page || tile_h % page != 0 || tile_h > 0xffff) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid tile size"));
+    }
+    unsigned int bits = fb->format == FRAMEBUF_MVLSB ? 8 : format_bpp[fb->format];
+    tl->ntx = (panel_width(fb) + tile_w - 1) / tile_w;
+    tl->nty = (panel_height(fb) + tile_h - 1) / tile_h;
+    tl->rows = (panel_height(fb) + page - 1) / page;
+    tl->band = tile_h / page;
+    tl->row_bytes = framebuf_row_bytes(fb->format, fb->stride);
+    tl->tile_bytes = (size_t)tile_w * bits / 8;
+    tl->bytes = ((size_t)panel_width(fb) * bits + 7) / 8;
+}
+
+// Whether n bytes of a and b differ, compared a word at a time when they
+// are aligned alike, as frame buffers of the same format usually are
+STATIC bool span_differs(const uint8_t *a, const uint8_t *b, size_t n) {
+    const size_t w = sizeof(mp_uint_t);
+    if ((((uintptr_t)a ^ (uintptr_t)b) & (w - 1)) == 0) {
+        for (; n > 0 && ((uintptr_t)a & (w - 1)) != 0; n--) {
+            if (*a++ != *b++) {
+                return true;
+            }
+        }
+        const mp_uint_t *wa = (const mp_uint_t *)a;
+        const mp_uint_t *wb = (const mp_uint_t *)b;
+        for (; n >= w; n -= w) {
+            if (*wa++ != *wb++) {
+                return true;
+            }
+        }
+        a = (const uint8_t *)wa;
+        b = (const uint8_t *)wb;
+    }
+    return memcmp(a, b, n) != 0;
+}
+
+STATIC mp_obj_framebuf_t *framebuf_get(mp_obj_t obj) {
+    mp_obj_t fb = mp_obj_cast_to_native_base(obj, MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (fb == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    return framebuf_follow(MP_OBJ_TO_PTR(fb));
+}
+
+// diff(a, b, tile=16) compares two frame buffers of the same format and
+// size, and returns the tiles that differ as a list of (x, y, w, h) rects.
+// Runs of tiles in a row become a rect, which grows down while the rows
+// below have the same run.
+STATIC mp_obj_t framebuf_diff(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    enum { ARG_a, ARG_b, ARG_tile };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_a, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_b, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_tile, MP_ARG_INT, {.u_int = 16} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    const mp_obj_framebuf_t *a = framebuf_get(args[ARG_a].u_obj);
+    const mp_obj_framebuf_t *b = framebuf_get(args[ARG_b].u_obj);
+    mp_int_t tile = args[ARG_tile].u_int;
+    if (a->format != b->format || panel_width(a) != panel_width(b) || panel_height(a) != panel_height(b)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("frame buffers differ in format or size"));
+    }
+    tile_layout_t tl;
+    tile_layout(&tl, a, tile, tile);
+    tile_check_view(b);
+    size_t b_row_bytes = framebuf_row_bytes(b->format, b->stride);
+
+    // rects in tiles, [x0, x1) x [y0, y1)
+    typedef struct {
+        uint16_t x0, x1, y0, y1;
+    } tile_rect_t;
+    size_t n = 0, alloc = 8;
+    tile_rect_t *rects = m_new(tile_rect_t, alloc);
+    uint8_t *dirty = m_new(uint8_t, tl.ntx);
+
+    for (mp_int_t ty = 0; ty < tl.nty; ty++) {
+        memset(dirty, 0, tl.ntx);
+        mp_int_t nd = 0;
+        for (mp_int_t r = ty * tl.band; r < MIN(tl.rows, (ty + 1) * tl.band) && nd < tl.ntx; r++) {
+            const uint8_t *pa = (const uint8_t *)a->buf + r * tl.row_bytes;
+            const uint8_t *pb = (const uint8_t *)b->buf + r * b_row_bytes;
+            if (!span_differs(pa, pb, tl.bytes)) {
+                continue; // most rows are unchanged
+            }
+            for (mp_int_t tx = 0; tx < tl.ntx; tx++) {
+                size_t off = tx * tl.tile_bytes;
+                if (!dirty[tx] && span_differs(pa + off, pb + off, MIN(tl.tile_bytes, tl.bytes - off))) {
+                    dirty[tx] = 1;
+                    nd++;
+                }
+            }
+        }
+
+        for (mp_int_t tx = 0; tx < tl.ntx && nd > 0; tx++) {
+            if (!dirty[tx]) {
+                continue;
+            }
+            mp_int_t x0 = tx;
+            while (tx < tl.ntx && dirty[tx]) {
+                tx++;
+            }
+            size_t i;
+            for (i = 0; i < n; i++) {
+                if (rects[i].y1 == ty && rects[i].x0 == x0 && rects[i].x1 == tx) {
+                    rects[i].y1 = ty + 1;
+                    break;
+                }
+            }
+            if (i == n) {
+                if (n == alloc) {
+                    rects = m_renew(tile_rect_t, rects, alloc, alloc * 2);
+                    alloc *= 2;
+                }
+                rects[n++] = (tile_rect_t) {x0, tx, ty, ty + 1};
+            }
+        }
+    }
+
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+    for (size_t i = 0; i < n; i++) {
+        mp_int_t x = rects[i].x0 * tile;
+        mp_int_t y = rects[i].y0 * tile;
+        mp_obj_t value[4];
+        value[0] = MP_OBJ_NEW_SMALL_INT(x);
+        value[1] = MP_OBJ_NEW_SMALL_INT(y);
+        value[2] = MP_OBJ_NEW_SMALL_INT(MIN(panel_width(a), rects[i].x1 * tile) - x);
+        value[3] = MP_OBJ_NEW_SMALL_INT(MIN(panel_height(a), rects[i].y1 * tile) - y);
+        mp_obj_list_append(list, mp_obj_new_tuple(4, value));
+    }
+    m_del(tile_rect_t, rects, alloc);
+    m_del(uint8_t, dirty, tl.ntx);
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(framebuf_diff_obj, 2, framebuf_diff);
+
+// xxHash32, fed with the rows of a tile one after the other
+#define XXH_PRIME1 (2654435761U)
+#define XXH_PRIME2 (2246822519U)
+#define XXH_PRIME3 (3266489917U)
+#define XXH_PRIME4 (668265263U)
+#define XXH_PRIME5 (374761393U)
+
+typedef struct {
+    uint32_t v[4];
+    uint32_t total;
+    uint8_t mem[16];
+    uint8_t n;
+} xxh32_t;
+
+static inline uint32_t xxh_rotl(uint32_t x, unsigned int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t input) {
+    return xxh_rotl(acc + input * XXH_PRIME2, 13) * XXH_PRIME1;
+}
+
+STATIC void xxh32_init(xxh32_t *h) {
+    h->v[0] = XXH_PRIME1 + XXH_PRIME2;
+    h->v[1] = XXH_PRIME2;
+    h->v[2] = 0;
+    h->v[3] = -XXH_PRIME1;
+    h->total = 0;
+    h->n = 0;
+}
+
+STATIC void xxh32_stripe(xxh32_t *h, const uint8_t *p) {
+    for (unsigned int i = 0; i < 4; i++) {
+        h->v[i] = xxh_round(h->v[i], xxh_read32(p + i * 4));
+    }
+}
+
+STATIC void xxh32_update(xxh32_t *h, const uint8_t *p, size_t len) {
+    h->total += len;
+    if (h->n + len < 16) {
+        memcpy(h->mem + h->n, p, len);
+        h->n += len;
+        return;
+    }
+    if (h->n) {
+        size_t fill = 16 - h->n;
+        memcpy(h->mem + h->n, p, fill);
+        xxh32_stripe(h, h->mem);
+        p += fill;
+        len -= fill;
+        h->n = 0;
+    }
+    for (; len >= 16; p += 16, len -= 16) {
+        xxh32_stripe(h, p);
+    }
+    memcpy(h->mem, p, len);
+    h->n = len;
+}
+
+STATIC uint32_t xxh32_digest(const xxh32_t *h) {
+    uint32_t acc;
+    if (h->total >= 16) {
+        acc = xxh_rotl(h->v[0], 1) + xxh_rotl(h->v[1], 7) + xxh_rotl(h->v[2], 12) + xxh_rotl(h->v[3], 18);
+    } else {
+        acc = XXH_PRIME5;
+    }
+    acc += h->total;
+    unsigned int i = 0;
+    for (; i + 4 <= h->n; i += 4) {
+        acc = xxh_rotl(acc + xxh_read32(h->mem + i) * XXH_PRIME3, 17) * XXH_PRIME4;
+    }
+    for (; i < h->n; i++) {
+        acc = xxh_rotl(acc + h->mem[i] * XXH_PRIME5, 11) * XXH_PRIME1;
+    }
+    acc ^= acc >> 15;
+    acc *= XXH_PRIME2;
+    acc ^= acc >> 13;
+    acc *= XXH_PRIME3;
+    acc ^= acc >> 16;
+    return acc;
+}
+
+// Bits of the last byte of a row that hold pixels, the others are padding
+STATIC uint8_t tile_last_mask(const mp_obj_framebuf_t *fb) {
+    unsigned int bits = panel_width(fb) * format_bpp[fb->format] % 8;
+    if (bits == 0 || fb->format == FRAMEBUF_MVLSB) {
+        return 0xff;
+    }
+    if (fb->format == FRAMEBUF_MHLSB || fb->format == FRAMEBUF_GS4_HMSB) {
+        return 0xff00 >> bits; // first pixel in the high bits
+    }
+    return (1 << bits) - 1;
+}
+
+// tile_hashes(tile_w, tile_h, out) stores the xxHash32 of each tile of the
+// frame buffer in out, an array('I') of at least cols * rows items, row by
+// row, and returns (cols, rows). Bits past the last pixel of a row or of
+// an MVLSB page don't count, so only a change of the pixels changes a hash.
+STATIC mp_obj_t framebuf_tile_hashes(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
+    tile_layout_t tl;
+    tile_layout(&tl, self, mp_obj_get_int(args_in[1]), mp_obj_get_int(args_in[2]));
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args_in[3], &bufinfo, MP_BUFFER_WRITE);
+    if (bufinfo.len < (size_t)tl.ntx * tl.nty * sizeof(uint32_t)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("hash array too small"));
+    }
+
+    uint8_t last_mask = tile_last_mask(self);
+    uint8_t page_mask = self->format == FRAMEBUF_MVLSB && panel_height(self) % 8 ? (1 << (panel_height(self) % 8)) - 1 : 0xff;
+    uint8_t *masked = m_new(uint8_t, tl.tile_bytes);
+    xxh32_t h;
+
+    for (mp_int_t ty = 0; ty < tl.nty; ty++) {
+        mp_int_t r1 = MIN(tl.rows, (ty + 1) * tl.band);
+        for (mp_int_t tx = 0; tx < tl.ntx; tx++) {
+            size_t off = tx * tl.tile_bytes;
+            size_t n = MIN(tl.tile_bytes, tl.bytes - off);
+            bool last = tx == tl.ntx - 1;
+            xxh32_init(&h);
+            for (mp_int_t r = ty * tl.band; r < r1; r++) {
+                const uint8_t *p = (const uint8_t *)self->buf + r * tl.row_bytes + off;
+                if (r == tl.rows - 1 && page_mask != 0xff) {
+                    for (size_t i = 0; i < n; i++) {
+                        masked[i] = p[i] & page_mask;
+                    }
+                    p = masked;
+                }
+                if (last && last_mask != 0xff) {
+                    xxh32_update(&h, p, n - 1);
+                    uint8_t b = p[n - 1] & last_mask;
+                    xxh32_update(&h, &b, 1);
+                } else {
+                    xxh32_update(&h, p, n);
+                }
+            }
+            uint32_t hash = xxh32_digest(&h);
+            memcpy((uint8_t *)bufinfo.buf + (ty * tl.ntx + tx) * sizeof(uint32_t), &hash, sizeof(hash));
+        }
+    }
+
+    m_del(uint8_t, masked, tl.tile_bytes);
+    mp_obj_t value[2];
+    value[0] = MP_OBJ_NEW_SMALL_INT(tl.ntx);
+    value[1] = MP_OBJ_NEW_SMALL_INT(tl.nty);
+    return mp_obj_new_tuple(2, value);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_tile_hashes_obj, 4, 4, framebuf_tile_hashes);
+#endif
+
 #if SUPPORT_GFX_FONT
 
 STATIC mp_obj_t framebuf_gfx(size_t n_args, const mp_obj_t *args_in) {
     // extract arguments
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     mp_obj_tuple_t *gfxFont = NULL;
     mp_buffer_info_t bufinfo;
 
@@ -1238,7 +2826,7 @@ STATIC alpha_blend_t alpha_blends[] = {
 //     consume: 2575 us
 STATIC mp_obj_t framebuf_write(size_t n_args, const mp_obj_t *args_in) {
     // extract arguments
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     if (!self->gfxFont) {
         mp_warning(NULL, "no usable gfx font found");
         return mp_const_none;
@@ -1255,6 +2843,7 @@ STATIC mp_obj_t framebuf_write(size_t n_args, const mp_obj_t *args_in) {
         props.fg_color = mp_obj_get_int(props_in->items[0]);
         props.bg_color = mp_obj_get_int(props_in->items[1]);
     }
+    record_call(self, DL_WRITE, n_args, args_in, NULL, MP_OBJ_NULL);
 
     // draw char
     int32_t local_cursor_x = x0;
@@ -1273,18 +2862,19 @@ STATIC mp_obj_t framebuf_write(size_t n_args, const mp_obj_t *args_in) {
         }
 
         uint8_t *bitmap = glygp_get_bitmap(self->gfxFont, glyph);
+        damage_add(self, local_cursor_x + glyph->left, local_cursor_y - glyph->top, glyph->width, glyph->height);
 
         // x y --> glyph
         // xx yy --> framebuf
         for (int32_t y = 0; y < glyph->height; y++) {
             int32_t yy = local_cursor_y - glyph->top + y;
-            if (yy < 0 || yy >= self->height) {
+            if (yy < self->clip_y0 || yy >= self->clip_y1) {
                 continue;
             }
             int32_t start_pos = local_cursor_x + glyph->left;
-            int32_t x = MAX(0, -start_pos);
-            int32_t max_x = MIN(start_pos + glyph->width, self->width);
-            for (int32_t xx = start_pos; xx < max_x; xx++) {
+            int32_t x = MAX(0, self->clip_x0 - start_pos);
+            int32_t max_x = MIN(start_pos + glyph->width, self->clip_x1);
+            for (int32_t xx = start_pos + x; xx < max_x; xx++) {
                 uint32_t alpha = glygp_get_alpha(self->gfxFont, glyph, bitmap, x, y);
                 uint32_t col = alpha_blends[self->format](&props, self->gfxFont->bpp, alpha);
                 setpixel(self, xx, yy, col);
@@ -1305,7 +2895,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_write_obj, 4, 5, framebuf_wr
 
 STATIC mp_obj_t framebuf_get_text_size(size_t n_args, const mp_obj_t *args_in) {
     // extract arguments
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args_in[0]));
     const char *str = mp_obj_str_get_str(args_in[1]);
 
     int32_t w = 0, h = 0;
@@ -1326,214 +2916,2421 @@ STATIC mp_obj_t framebuf_get_text_size(size_t n_args, const mp_obj_t *args_in) {
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_get_text_size_obj, 2, 2, framebuf_get_text_size);
 #endif // SUPPORT_GFX_FONT
 
-#if SUPPORT_JPG
-// Returns number of bytes read (zero on error)
-STATIC unsigned int buffer_in_func(JDEC *jd, uint8_t *buff, unsigned int nbyte) {
-    IODEV *dev = (IODEV *) jd->device;
-
-    mp_printf(&mp_plat_print, "buffer_in_func\n");
+#if SUPPORT_IMG_IO
+// Refill the block buffer, reads end on a filesystem block boundary
+STATIC unsigned int file_fill(IODEV *dev) {
+    unsigned int nbyte = dev->blk_size - (unsigned int)(dev->fpos % IMG_FILE_ALIGN);
+    int errcode;
 
-    if (dev->data_index + nbyte > dev->data_len) {
-        nbyte = dev->data_len - dev->data_index;
-    }
+    dev->blk_len = (unsigned int)mp_stream_rw(dev->fp, dev->blk, nbyte, &errcode, MP_STREAM_RW_READ);
+    dev->blk_index = 0;
+    dev->fpos += dev->blk_len;
+    return dev->blk_len;
+}
 
-    if (buff) {
-        memcpy(buff, (uint8_t *) (dev->data + dev->data_index), nbyte);
+// Reads nbyte bytes into buff, or skips them if buff is NULL.
+// Returns number of bytes read (zero on error)
+STATIC unsigned int img_read(IODEV *dev, uint8_t *buff, unsigned int nbyte) {
+    if (dev->fp == MP_OBJ_NULL) {
+        if (nbyte > dev->data_len - dev->data_index) {
+            nbyte = dev->data_len - dev->data_index;
+        }
+        if (buff) {
+            memcpy(buff, dev->data + dev->data_index, nbyte);
+        }
+        dev->data_index += nbyte;
+        return nbyte;
     }
 
-    dev->data_index += nbyte;
+    unsigned int done = 0;
+    while (done < nbyte) {
+        unsigned int avail = dev->blk_len - dev->blk_index;
+        if (avail == 0) {
+            unsigned int rest = nbyte - done;
+            if (buff && rest >= dev->blk_size) {
+                // Large reads go straight to the destination
+                int errcode;
+                unsigned int n = (unsigned int)mp_stream_rw(dev->fp, buff + done, rest, &errcode, MP_STREAM_RW_READ);
+                dev->fpos += n;
+                done += n;
+                break;
+            }
+            if (buff == NULL && rest > dev->blk_size) {
+                // Remove data from input stream by seeking over it
+                int errcode;
+                mp_off_t pos = mp_stream_seek(dev->fp, rest, MP_SEEK_CUR, &errcode);
+                if (pos == (mp_off_t)-1) {
+                    break;
+                }
+                dev->fpos = pos;
+                done += rest;
+                break;
+            }
+            if (file_fill(dev) == 0) {
+                break;
+            }
+            continue;
+        }
+
+        unsigned int n = MIN(avail, nbyte - done);
+        if (buff) {
+            memcpy(buff + done, dev->blk + dev->blk_index, n);
+        }
+        dev->blk_index += n;
+        done += n;
+    }
+
+    return done;
+}
+
+// Points ptr to up to nbyte next bytes in place, in the buffer or in the
+// block buffer of a file, so that they are never copied.
+// Returns number of bytes available (zero on error or at the end)
+STATIC unsigned int img_ref(IODEV *dev, const uint8_t **ptr, unsigned int nbyte) {
+    if (dev->fp == MP_OBJ_NULL) {
+        nbyte = MIN(nbyte, dev->data_len - dev->data_index);
+        *ptr = dev->data + dev->data_index;
+        dev->data_index += nbyte;
+        return nbyte;
+    }
+
+    if (dev->blk_index >= dev->blk_len && file_fill(dev) == 0) {
+        return 0;
+    }
+    nbyte = MIN(nbyte, dev->blk_len - dev->blk_index);
+    *ptr = dev->blk + dev->blk_index;
+    dev->blk_index += nbyte;
     return nbyte;
 }
 
+// Opens src, a file name or any object exposing a readable buffer
+STATIC void img_open(IODEV *dev, mp_obj_t src) {
+    dev->fp = MP_OBJ_NULL;
+    dev->data = NULL;
+    dev->data_index = 0;
+    dev->data_len = 0;
+    dev->blk_index = 0;
+    dev->blk_len = 0;
+    dev->fpos = 0;
+
+    if (mp_obj_is_str(src)) {
+        mp_obj_t vfs_args[2] = {
+            src,
+            MP_OBJ_NEW_QSTR(MP_QSTR_rb),
+        };
+        if (dev->blk == NULL) {
+            dev->blk = m_new(uint8_t, dev->blk_size);
+        }
+        dev->fp = mp_vfs_open(MP_ARRAY_SIZE(vfs_args), &vfs_args[0], (mp_map_t *)&mp_const_empty_map);
+        return;
+    }
+
+    // bytes, bytearray, memoryview or anything else exposing a readable buffer
+    mp_buffer_info_t bufinfo;
+    if (!mp_get_buffer(src, &bufinfo, MP_BUFFER_READ)) {
+        mp_raise_TypeError(MP_ERROR_TEXT("expecting a filename or a buffer"));
+    }
+    dev->src = src;
+    dev->data = bufinfo.buf;
+    dev->data_len = bufinfo.len;
+}
+
+STATIC bool img_rewind(IODEV *dev) {
+    if (dev->fp != MP_OBJ_NULL) {
+        int errcode;
+        dev->blk_index = 0;
+        dev->blk_len = 0;
+        dev->fpos = 0;
+        return mp_stream_seek(dev->fp, 0, MP_SEEK_SET, &errcode) == 0;
+    }
+    dev->data_index = 0;
+    return true;
+}
+
+STATIC void img_close(IODEV *dev) {
+    if (dev->fp != MP_OBJ_NULL) {
+        mp_stream_close(dev->fp);
+        dev->fp = MP_OBJ_NULL;
+    }
+    dev->src = MP_OBJ_NULL;
+    dev->data = NULL;
+    dev->fb = NULL; // no decode in progress
+}
+#endif // SUPPORT_IMG_IO
+
+#if SUPPORT_IMG_CACHE
+#define IMG_CACHE_JPG (0)
+#define IMG_CACHE_PNG (1)
+
+// What identifies a decoded image: file names are compared by value, buffers
+// by identity, the object and the data it exposed when the image was cached
+typedef struct {
+    mp_obj_t src;
+    const void *data;
+    size_t len;
+    mp_int_t crop[4]; /* crop window, crop[2] is 0 for the whole image */
+    uint8_t kind;
+    uint8_t format;
+    uint8_t dither; /* DITHER_xxx of jpeg images, 0 for none */
+    const uint8_t *tone; /* tone curve of the frame buffer */
+} img_cache_key_t;
+
+typedef struct _img_cache_entry_t {
+    struct _img_cache_entry_t *next; /* the next less recently used entry */
+    img_cache_key_t key;
+    size_t size;          /* bytes counted against the budget */
+    uint16_t width, height; /* size of the image, returned by jpg() and png() */
+    mp_int_t ox, oy;      /* position of the pixels in the drawn window */
+    uint8_t *mask;        /* bit set for each opaque pixel, NULL if all of them are */
+    mp_obj_framebuf_t fb; /* the decoded pixels, in the format of the key */
+} img_cache_entry_t;
+
+// Budget and counters, the entries hang from MP_STATE_VM(framebuf_plus_cache)
+STATIC struct {
+    size_t budget;
+    size_t used;
+    mp_uint_t hits;
+    mp_uint_t misses;
+    mp_uint_t evictions;
+    mp_uint_t count;
+} img_cache;
+
+MP_REGISTER_ROOT_POINTER(struct _img_cache_entry_t *framebuf_plus_cache);
+
+STATIC void img_cache_key(img_cache_key_t *key, uint8_t kind, mp_obj_t src, const mp_obj_framebuf_t *fb, const mp_int_t *crop, uint8_t dither) {
+    memset(key, 0, sizeof(*key));
+    key->src = src;
+    key->kind = kind;
+    key->format = fb->format;
+    key->tone = fb->tone;
+    key->dither = dither;
+    if (crop != NULL) {
+        memcpy(key->crop, crop, sizeof(key->crop));
+    }
+    if (!mp_obj_is_str(src)) {
+        mp_buffer_info_t bufinfo;
+        if (mp_get_buffer(src, &bufinfo, MP_BUFFER_READ)) {
+            key->data = bufinfo.buf;
+            key->len = bufinfo.len;
+        }
+    }
+}
+
+STATIC bool img_cache_match(const img_cache_key_t *a, const img_cache_key_t *b) {
+    if (a->kind != b->kind || a->format != b->format || a->dither != b->dither || a->tone != b->tone || memcmp(a->crop, b->crop, sizeof(a->crop)) != 0) {
+        return false;
+    }
+    if (mp_obj_is_str(a->src)) {
+        return mp_obj_is_str(b->src) && mp_obj_equal(a->src, b->src);
+    }
+    return a->src == b->src && a->data == b->data && a->len == b->len;
+}
+
+// Returns the entry of key and makes it the most recently used one, or NULL
+STATIC img_cache_entry_t *img_cache_get(const img_cache_key_t *key) {
+    img_cache_entry_t **prev = &MP_STATE_VM(framebuf_plus_cache);
+    for (img_cache_entry_t *e = *prev; e != NULL; prev = &e->next, e = e->next) {
+        if (img_cache_match(&e->key, key)) {
+            *prev = e->next;
+            e->next = MP_STATE_VM(framebuf_plus_cache);
+            MP_STATE_VM(framebuf_plus_cache) = e;
+            img_cache.hits++;
+            return e;
+        }
+    }
+    img_cache.misses++;
+    return NULL;
+}
+
+// Drops the least recently used entries until at most size bytes are used
+STATIC void img_cache_trim(size_t size, bool evict) {
+    while (img_cache.used > size) {
+        img_cache_entry_t **last = &MP_STATE_VM(framebuf_plus_cache);
+        while ((*last)->next != NULL) {
+            last = &(*last)->next;
+        }
+        img_cache_entry_t *e = *last;
+        *last = NULL;
+        img_cache.used -= e->size;
+        img_cache.count--;
+        if (evict) {
+            img_cache.evictions++;
+        }
+        m_del(uint8_t, e, e->size);
+    }
+}
+
+// Allocates an entry for w x h pixels of the key's format, with an opacity
+// mask if needed. Returns NULL if it doesn't fit the budget or the heap, the
+// entry is only added to the cache by img_cache_add once decoded.
+STATIC img_cache_entry_t *img_cache_new(const img_cache_key_t *key, mp_int_t w, mp_int_t h, bool masked) {
+    if (w <= 0 || h <= 0 || w > 0xffff || h > 0xffff) {
+        return NULL;
+    }
+    mp_int_t stride = framebuf_stride(key->format, w);
+    size_t rows = key->format == FRAMEBUF_MVLSB ? (h + 7) / 8 : h;
+    size_t pixels = framebuf_row_bytes(key->format, stride) * rows;
+    size_t mask = masked ? (w + 7) / 8 * h : 0;
+    size_t size = sizeof(img_cache_entry_t) + pixels + mask;
+    if (size > img_cache.budget) {
+        return NULL;
+    }
+
+    img_cache_trim(img_cache.budget - size, true);
+    img_cache_entry_t *e = m_malloc_maybe(size);
+    if (e == NULL) {
+        return NULL;
+    }
+    memset(e, 0, sizeof(*e));
+    e->key = *key;
+    e->size = size;
+    e->fb.buf_obj = MP_OBJ_NULL;
+    e->fb.buf = (uint8_t *)(e + 1);
+    e->fb.width = w;
+    e->fb.height = h;
+    e->fb.stride = stride;
+    e->fb.format = key->format;
+    e->fb.tone = key->tone;
+    clip_reset(&e->fb);
+    if (masked) {
+        e->mask = (uint8_t *)(e + 1) + pixels;
+        memset(e->mask, 0, mask);
+    }
+    return e;
+}
+
+STATIC void img_cache_add(img_cache_entry_t *e) {
+    e->next = MP_STATE_VM(framebuf_plus_cache);
+    MP_STATE_VM(framebuf_plus_cache) = e;
+    img_cache.used += e->size;
+    img_cache.count++;
+}
+
+// Draws the pixels of an entry into fb, with (0, 0) of the drawn window at (x, y).
+// Rows are copied a byte at a time where the pixels line up with the bytes.
+STATIC void img_cache_blit(const mp_obj_framebuf_t *fb, const img_cache_entry_t *e, mp_int_t x, mp_int_t y) {
+    const mp_obj_framebuf_t *src = &e->fb;
+    x += e->ox;
+    y += e->oy;
+    mp_int_t x0 = MAX(0, fb->clip_x0 - x);
+    mp_int_t y0 = MAX(0, fb->clip_y0 - y);
+    mp_int_t x1 = MIN(src->width, fb->clip_x1 - x);
+    mp_int_t y1 = MIN(src->height, fb->clip_y1 - y);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    damage_add(fb, x + x0, y + y0, x1 - x0, y1 - y0);
+
+    unsigned int bpp = format_bpp[fb->format];
+    size_t src_row = framebuf_row_bytes(src->format, src->stride);
+    size_t fb_row = framebuf_row_bytes(fb->format, fb->stride);
+    size_t mask_row = (src->width + 7) / 8;
+    bool copy = e->mask == NULL && fb->format != FRAMEBUF_MVLSB && !fb->rotate
+        && (x0 * bpp) % 8 == 0 && ((x + x0 + fb->xoff) * bpp) % 8 == 0;
+    mp_int_t n = copy ? (x1 - x0) * bpp / 8 * 8 / bpp : 0; // pixels copied as whole bytes
+
+    for (mp_int_t j = y0; j < y1; j++) {
+        if (n > 0) {
+            memcpy((uint8_t *)fb->buf + (y + j) * fb_row + (x + x0 + fb->xoff) * bpp / 8,
+                (const uint8_t *)src->buf + j * src_row + x0 * bpp / 8, n * bpp / 8);
+        }
+        for (mp_int_t i = x0 + n; i < x1; i++) {
+            if (e->mask != NULL && !(e->mask[j * mask_row + (i >> 3)] & (1 << (i & 7)))) {
+                continue;
+            }
+            setpixel(fb, x + i, y + j, getpixel(src, i, j));
+        }
+    }
+}
+
+// cache(budget) sets the bytes the cache may use, 0 (the default) disables it
+STATIC mp_obj_t framebuf_cache(mp_obj_t budget_in) {
+    mp_int_t budget = mp_obj_get_int(budget_in);
+    if (budget < 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid budget"));
+    }
+    img_cache.budget = budget;
+    img_cache_trim(budget, true);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(framebuf_cache_obj, framebuf_cache);
+
+// cache_clear() drops all entries, e.g. after a cached file or buffer is rewritten
+STATIC mp_obj_t framebuf_cache_clear(void) {
+    img_cache_trim(0, false);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(framebuf_cache_clear_obj, framebuf_cache_clear);
+
+// cache_info() returns (hits, misses, evictions, entries, used bytes, budget)
+STATIC mp_obj_t framebuf_cache_info(void) {
+    mp_obj_t value[6];
+    value[0] = mp_obj_new_int_from_uint(img_cache.hits);
+    value[1] = mp_obj_new_int_from_uint(img_cache.misses);
+    value[2] = mp_obj_new_int_from_uint(img_cache.evictions);
+    value[3] = mp_obj_new_int_from_uint(img_cache.count);
+    value[4] = mp_obj_new_int_from_uint(img_cache.used);
+    value[5] = mp_obj_new_int_from_uint(img_cache.budget);
+    return mp_obj_new_tuple(6, value);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(framebuf_cache_info_obj, framebuf_cache_info);
+
+#if MICROPY_MODULE_BUILTIN_INIT
+// Called on each first import, the heap of the cached entries is gone after a soft reset
+STATIC mp_obj_t framebuf_module_init(void) {
+    MP_STATE_VM(framebuf_plus_cache) = NULL;
+    memset(&img_cache, 0, sizeof(img_cache));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(framebuf_module_init_obj, framebuf_module_init);
+#endif
+#endif // SUPPORT_IMG_CACHE
+
+#if SUPPORT_JPG
+// tjpgd input function, returns number of bytes read (zero on error)
+STATIC unsigned int jpg_in_func(JDEC *jd, uint8_t *buff, unsigned int nbyte) {
+    return img_read((IODEV *)jd->device, buff, nbyte);
+}
+
+// Hands the rest of the buffer, or of the file block, to tjpgd in place
+STATIC unsigned int jpg_in_ref(JDEC *jd, uint8_t **dptr) {
+    return img_ref((IODEV *)jd->device, (const uint8_t **)dptr, ~0u);
+}
+
+#if SUPPORT_DITHER
+// Dithered output of the clipped part (xs, ys)-(xe, ye) of a rectangle. Bayer
+// pixels are drawn right away. Error diffusion needs the rows in order, so
+// they are kept in the band until the last MCU of their row comes out.
+STATIC int out_dither(JDEC *jd, const uint8_t *bitmap, const JRECT *rect, mp_int_t xs, mp_int_t ys, mp_int_t xe, mp_int_t ye) {
+    IODEV *dev = (IODEV *)jd->device;
+    const mp_obj_framebuf_t *fb = dev->fb;
+    dither_t *d = &dev->dither;
+    mp_int_t w = rect->right - rect->left + 1;
+
+    for (mp_int_t yy = ys; yy <= ye; yy++) {
+        const uint8_t *src = bitmap + 3 * ((yy - rect->top) * w + xs - rect->left);
+        for (mp_int_t xx = xs; xx <= xe; xx++) {
+            unsigned int v = rgb888_to_gray(fb, src[0], src[1], src[2]);
+            if (d->mode == DITHER_BAYER) {
+                setpixel(fb, dev->x + xx, dev->y + yy, dither_bayer(v, d->levels, dev->x + xx, dev->y + yy));
+            } else {
+                dev->band[(yy - rect->top) * d->width + xx - dev->rgn.left] = v;
+            }
+            src += 3;
+        }
+    }
+
+    if (d->mode != DITHER_BAYER && xe == dev->rgn.right) {
+        for (mp_int_t yy = ys; yy <= ye; yy++) {
+            dither_row(d, dev->band + (yy - rect->top) * d->width, fb, dev->x + dev->rgn.left, dev->y + yy);
+        }
+    }
+    return 1;
+}
+#endif
+
+// Convert the decoded RGB888 rectangle straight into the frame buffer
+STATIC int out_framebuf(JDEC *jd, void *bitmap, JRECT *rect) {
+    IODEV *dev = (IODEV *)jd->device;
+    const mp_obj_framebuf_t *fb = dev->fb;
+    color_converts_t convert = converts[fb->format];
+    mp_int_t w = rect->right - rect->left + 1;
+
+    // clip to the output region
+    mp_int_t xs = MAX(rect->left, dev->rgn.left);
+    mp_int_t ys = MAX(rect->top, dev->rgn.top);
+    mp_int_t xe = MIN(rect->right, dev->rgn.right);
+    mp_int_t ye = MIN(rect->bottom, dev->rgn.bottom);
+
+    #if SUPPORT_DITHER
+    if (dev->dither.mode != DITHER_NONE) {
+        return out_dither(jd, bitmap, rect, xs, ys, xe, ye);
+    }
+    #endif
+
+    for (mp_int_t yy = ys; yy <= ye; yy++) {
+        const uint8_t *src = (const uint8_t *)bitmap + 3 * ((yy - rect->top) * w + xs - rect->left);
+        for (mp_int_t xx = xs; xx <= xe; xx++) {
+            setpixel(fb, dev->x + xx, dev->y + yy, convert(fb, src[0], src[1], src[2]));
+            src += 3;
+        }
+    }
+
+    return 1; // Continue to decompress
+}
+
+#if SUPPORT_JPG_THREADS
+STATIC void *jpg_worker(void *arg) {
+    jpg_worker_t *w = arg;
+    w->res = jd_decomp_part(&w->jdec, out_framebuf, 0, &w->dev.rgn, w->first, w->count);
+    return NULL;
+}
+
+// Split the restart intervals holding the output region between the calling
+// thread and up to threads - 1 workers. They share the tables and read the
+// input buffer in place, and each writes its own MCUs of fb. That needs 8 or
+// more bits per pixel: sub-byte formats pack pixels of neighbouring MCUs into
+// the same bytes, so they are decoded on the calling thread only, as are
+// files and images without restart intervals.
+STATIC JRESULT jpg_decomp_threads(mp_obj_jpegdec_t *dec) {
+    JDEC *jd = &dec->jdec;
+    IODEV *dev = &dec->dev;
+    int format = dev->fb->format;
+
+    if (dec->threads < 2 || jd->nrst == 0 || dev->data == NULL
+        || (format != FRAMEBUF_RGB565 && format != FRAMEBUF_GS8 && format != FRAMEBUF_RGB888)) {
+        return jd_decomp_step(jd, out_framebuf, 0);
+    }
+
+    unsigned int mx = jd->msx * 8;
+    unsigned int my = jd->msy * 8;
+    unsigned int nx = (jd->width + mx - 1) / mx;
+    unsigned int i0 = dev->rgn.top / my * nx / jd->nrst;
+    unsigned int i1 = ((dev->rgn.bottom / my + 1) * nx + jd->nrst - 1) / jd->nrst;
+    unsigned int n = MIN(dec->threads, i1 - i0);
+    pthread_t tid[JPG_THREADS_MAX];
+    bool started[JPG_THREADS_MAX];
+
+    if (dec->workers == NULL) {
+        dec->workers = m_new(jpg_worker_t, dec->threads - 1);
+    }
+
+    // workers start from the stream position of jd, so fork all of them first
+    for (unsigned int k = 1; k < n; k++) {
+        jpg_worker_t *w = &dec->workers[k - 1];
+        w->dev = *dev;
+        w->first = i0 + (i1 - i0) * k / n;
+        w->count = i0 + (i1 - i0) * (k + 1) / n - w->first;
+        w->res = jd_fork(jd, &w->jdec, w->work, sizeof(w->work), &w->dev);
+    }
+    for (unsigned int k = 1; k < n; k++) {
+        jpg_worker_t *w = &dec->workers[k - 1];
+        started[k] = w->res == JDR_OK && pthread_create(&tid[k], NULL, jpg_worker, w) == 0;
+    }
+
+    JRESULT res = jd_decomp_part(jd, out_framebuf, 0, &dev->rgn, i0, (i1 - i0) / n);
+
+    for (unsigned int k = 1; k < n; k++) {
+        jpg_worker_t *w = &dec->workers[k - 1];
+        if (started[k]) {
+            pthread_join(tid[k], NULL);
+        } else if (w->res == JDR_OK) {
+            jpg_worker(w); // no thread available, decode it here
+        }
+        if (res == JDR_OK) {
+            res = w->res;
+        }
+    }
+    return res;
+}
+#endif
+
+// Closes the source and frees the dithering buffers of a decode
+STATIC void jpg_close(mp_obj_jpegdec_t *dec) {
+    IODEV *dev = &dec->dev;
+    #if SUPPORT_DITHER
+    if (dev->band != NULL) {
+        m_del(uint8_t, dev->band, dev->dither.width * dec->jdec.msy * 8);
+        dev->band = NULL;
+    }
+    dither_deinit(&dev->dither);
+    #endif
+    img_close(dev);
+}
+
+// Set up the decode of src into fb at (x, y) with the decoder's pool. The pool
+// is allocated on first use and grown once if an image needs larger tables.
+// crop is NULL or {cx, cy, cw, ch}: only that part of the image is drawn, with
+// (cx, cy) at (x, y). MCUs outside the drawn part are not decompressed.
+// dither is one of DITHER_xxx, for gray and mono frame buffers.
+// Returns false if nothing of the image is drawn, the source is closed then.
+STATIC bool jpg_start(mp_obj_jpegdec_t *dec, const mp_obj_framebuf_t *fb, mp_obj_t src, mp_int_t x, mp_int_t y, const mp_int_t *crop, uint8_t dither) {
+    if (dec->pool == NULL) {
+        dec->pool = m_new(uint8_t, JPG_POOL_SIZE);
+        dec->sz_pool = JPG_POOL_SIZE;
+    }
+
+    JDEC *jd = &dec->jdec;
+    IODEV *dev = &dec->dev;
+    jpg_close(dec); // abandon an unfinished decode
+    img_open(dev, src);
+    dev->fb = fb;
+
+    JRESULT res = jd_prepare(jd, jpg_in_func, dec->pool, dec->sz_pool, dev);
+    if (res == JDR_MEM1 && dec->sz_pool < JPG_POOL_MAX && img_rewind(dev)) {
+        dec->pool = m_renew(uint8_t, dec->pool, dec->sz_pool, JPG_POOL_MAX);
+        dec->sz_pool = JPG_POOL_MAX;
+        res = jd_prepare(jd, jpg_in_func, dec->pool, dec->sz_pool, dev);
+    }
+    if (res != JDR_OK) {
+        jpg_close(dec);
+        mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(jd_prepare)"), jd_errors[res]);
+    }
+
+    // intersect the crop window with the image and the clip window of fb
+    mp_int_t cx = 0, cy = 0;
+    mp_int_t l = 0, t = 0, r = jd->width - 1, b = jd->height - 1;
+    if (crop != NULL) {
+        cx = crop[0];
+        cy = crop[1];
+        l = MAX(l, cx);
+        t = MAX(t, cy);
+        r = MIN(r, cx + crop[2] - 1);
+        b = MIN(b, cy + crop[3] - 1);
+    }
+    dev->x = x - cx;
+    dev->y = y - cy;
+    l = MAX(l, fb->clip_x0 - dev->x);
+    t = MAX(t, fb->clip_y0 - dev->y);
+    r = MIN(r, fb->clip_x1 - 1 - dev->x);
+    b = MIN(b, fb->clip_y1 - 1 - dev->y);
+    if (l > r || t > b) {
+        jpg_close(dec);
+        return false;
+    }
+    dev->rgn.left = l;
+    dev->rgn.top = t;
+    dev->rgn.right = r;
+    dev->rgn.bottom = b;
+    damage_add(fb, dev->x + l, dev->y + t, r - l + 1, b - t + 1);
+
+    #if SUPPORT_DITHER
+    dither_init(&dev->dither, dither, fb->format, r - l + 1);
+    if (dev->dither.err != NULL) {
+        dev->band = m_new(uint8_t, dev->dither.width * jd->msy * 8);
+    }
+    #endif
+
+    jd->inref = jpg_in_ref;
+    jd_decomp_start(jd, 0, &dev->rgn, 0, 0);
+    return true;
+}
+
+// Decode up to nmcu MCUs (0: all) of the image set up by jpg_start. Returns
+// the number of MCUs left, the source is closed once it reaches 0.
+STATIC unsigned int jpg_step(mp_obj_jpegdec_t *dec, unsigned int nmcu) {
+    JDEC *jd = &dec->jdec;
+    IODEV *dev = &dec->dev;
+
+    if (dev->fb == NULL) {
+        return 0;
+    }
+    framebuf_follow((mp_obj_framebuf_t *)dev->fb); // swapped since start()
+
+    JRESULT res = jd_decomp_step(jd, out_framebuf, nmcu);
+    if (res != JDR_OK || jd->mcu >= jd->nmcu) {
+        jpg_close(dec);
+    }
+    if (res != JDR_OK) {
+        mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(jd_decomp)"), jd_errors[res]);
+    }
+    return jd->nmcu - jd->mcu;
+}
+
+// Decode all of the image set up by jpg_start
+STATIC void jpg_finish(mp_obj_jpegdec_t *dec) {
+    #if SUPPORT_JPG_THREADS
+    JRESULT res = jpg_decomp_threads(dec);
+    #else
+    JRESULT res = jd_decomp_step(&dec->jdec, out_framebuf, 0);
+    #endif
+    jpg_close(dec);
+    if (res != JDR_OK) {
+        mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(jd_decomp)"), jd_errors[res]);
+    }
+}
+
+// Decode src into fb at (x, y) in one go, see jpg_start
+STATIC void jpg_decode(mp_obj_jpegdec_t *dec, const mp_obj_framebuf_t *fb, mp_obj_t src, mp_int_t x, mp_int_t y, const mp_int_t *crop, uint8_t dither) {
+    if (jpg_start(dec, fb, src, x, y, crop, dither)) {
+        jpg_finish(dec);
+    }
+}
+
+// Reads the headers of src into jd, without allocating a pool
+STATIC void jpg_probe(JDEC *jd, mp_obj_t src) {
+    IODEV dev;
+    uint8_t blk[IMG_FILE_ALIGN]; // files are read one filesystem block at a time
+
+    memset(&dev, 0, sizeof(dev));
+    dev.blk = blk;
+    dev.blk_size = sizeof(blk);
+    img_open(&dev, src);
+    JRESULT res = jd_probe(jd, jpg_in_func, &dev);
+    img_close(&dev);
+    if (res != JDR_OK) {
+        mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(jd_probe)"), jd_errors[res]);
+    }
+}
+
+#if SUPPORT_IMG_CACHE
+// Decodes the part of the image that jpg() draws into a new cache entry.
+// Returns NULL if it isn't cached, the caller decodes into the fb then.
+STATIC img_cache_entry_t *jpg_cache(mp_obj_jpegdec_t *dec, const img_cache_key_t *key, const mp_int_t *crop) {
+    JDEC jd;
+    jpg_probe(&jd, key->src);
+
+    mp_int_t cx = 0, cy = 0;
+    mp_int_t l = 0, t = 0, r = jd.width, b = jd.height;
+    if (crop != NULL) {
+        cx = crop[0];
+        cy = crop[1];
+        l = MAX(l, cx);
+        t = MAX(t, cy);
+        r = MIN(r, cx + crop[2]);
+        b = MIN(b, cy + crop[3]);
+    }
+    img_cache_entry_t *e = img_cache_new(key, r - l, b - t, false);
+    if (e == NULL) {
+        return NULL;
+    }
+    e->width = jd.width;
+    e->height = jd.height;
+    e->ox = l - cx;
+    e->oy = t - cy;
+    jpg_decode(dec, &e->fb, key->src, -e->ox, -e->oy, crop, key->dither);
+    img_cache_add(e);
+    return e;
+}
+#endif
+
+enum { ARG_jpg_src, ARG_jpg_x, ARG_jpg_y, ARG_jpg_crop, ARG_jpg_dither };
+STATIC const mp_arg_t jpg_allowed_args[] = {
+    { MP_QSTR_src, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+    { MP_QSTR_x, MP_ARG_INT, {.u_int = 0} },
+    { MP_QSTR_y, MP_ARG_INT, {.u_int = 0} },
+    { MP_QSTR_crop, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+    #if SUPPORT_DITHER
+    { MP_QSTR_dither, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = DITHER_NONE} },
+    #endif
+};
+#if SUPPORT_DITHER
+#define JPG_ARG_DITHER(args) dither_mode((args)[ARG_jpg_dither].u_int)
+#else
+#define JPG_ARG_DITHER(args) (0)
+#endif
+
+// Returns crop (a tuple of (cx, cy, cw, ch) or None) as an array, or NULL
+STATIC const mp_int_t *jpg_get_crop(mp_obj_t crop_in, mp_int_t *crop) {
+    if (crop_in == mp_const_none) {
+        return NULL;
+    }
+    mp_obj_t *items;
+    mp_obj_get_array_fixed_n(crop_in, 4, &items);
+    for (int i = 0; i < 4; i++) {
+        crop[i] = mp_obj_get_int(items[i]);
+    }
+    if (crop[2] <= 0 || crop[3] <= 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid crop"));
+    }
+    return crop;
+}
+
+// args:
+//     0    1   2 3
+//     self src x y *, crop
+STATIC mp_obj_t framebuf_jpg(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(pos_args[0]));
+    mp_arg_val_t args[MP_ARRAY_SIZE(jpg_allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(jpg_allowed_args), jpg_allowed_args, args);
+    mp_int_t x = args[ARG_jpg_x].u_int;
+    mp_int_t y = args[ARG_jpg_y].u_int;
+    mp_int_t crop[4];
+
+    if (x >= self->width || y >= self->height) {
+        record_call(self, DL_JPG, n_args, pos_args, kw_args, MP_OBJ_NULL);
+        return mp_const_none;
+    }
+
+    // one-shot decode with a temporary pool and block buffer
+    mp_obj_t src = args[ARG_jpg_src].u_obj;
+    const mp_int_t *pcrop = jpg_get_crop(args[ARG_jpg_crop].u_obj, crop);
+    uint8_t dither = JPG_ARG_DITHER(args);
+    mp_obj_jpegdec_t dec;
+    memset(&dec, 0, sizeof(dec));
+    dec.dev.blk_size = IMG_FILE_BUF;
+    #if SUPPORT_IMG_CACHE
+    img_cache_entry_t *e = NULL;
+    if (img_cache.budget > 0) {
+        img_cache_key_t key;
+        img_cache_key(&key, IMG_CACHE_JPG, src, self, pcrop, dither);
+        e = img_cache_get(&key);
+        if (e == NULL) {
+            e = jpg_cache(&dec, &key, pcrop);
+        }
+    }
+    if (e != NULL) {
+        img_cache_blit(self, e, x, y);
+        dec.jdec.width = e->width;
+        dec.jdec.height = e->height;
+    } else
+    #endif
+    jpg_decode(&dec, self, src, x, y, pcrop, dither);
+    m_del(uint8_t, dec.pool, dec.sz_pool);
+    m_del(uint8_t, dec.dev.blk, dec.dev.blk_size);
+
+    mp_obj_t value[2];
+    value[0] = mp_obj_new_int(dec.jdec.width);
+    value[1] = mp_obj_new_int(dec.jdec.height);
+    mp_obj_t ret = mp_obj_new_tuple(2, value);
+    record_call(self, DL_JPG, n_args, pos_args, kw_args, ret);
+    return ret;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(framebuf_jpg_obj, 2, framebuf_jpg);
+
+STATIC mp_obj_t jpegdec_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args_in) {
+    enum { ARG_pool_size, ARG_bufsize, ARG_threads };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_pool_size, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_bufsize, MP_ARG_INT, {.u_int = IMG_FILE_BUF} },
+        { MP_QSTR_threads, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1} },
+    };
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args_in, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_obj_jpegdec_t *o = mp_obj_malloc(mp_obj_jpegdec_t, type);
+    memset(&o->jdec, 0, sizeof(o->jdec));
+    memset(&o->dev, 0, sizeof(o->dev));
+    o->pool = NULL;
+    o->sz_pool = 0;
+
+    if (args[ARG_pool_size].u_int) {
+        // preallocate the pool, otherwise it is sized by the first image
+        mp_int_t sz_pool = args[ARG_pool_size].u_int;
+        if (sz_pool < JD_SZBUF || sz_pool > 0xffff) {
+            mp_raise_ValueError(MP_ERROR_TEXT("invalid pool size"));
+        }
+        o->pool = m_new(uint8_t, sz_pool);
+        o->sz_pool = sz_pool;
+    }
+
+    // file block buffer, allocated by the first file decode
+    mp_int_t bufsize = args[ARG_bufsize].u_int;
+    if (bufsize < IMG_FILE_ALIGN) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid buffer size"));
+    }
+    o->dev.blk_size = (bufsize + IMG_FILE_ALIGN - 1) & ~(IMG_FILE_ALIGN - 1);
+
+    // threads=0 uses all online CPUs, ports without threads always decode on one
+    mp_int_t threads = args[ARG_threads].u_int;
+    if (threads < 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid threads"));
+    }
+    #if SUPPORT_JPG_THREADS
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    o->threads = MAX(1, MIN(threads, JPG_THREADS_MAX));
+    o->workers = NULL;
+    #endif
+
+    return MP_OBJ_FROM_PTR(o);
+}
+
+// Parses the arguments of decode() and start(), and sets up the decode
+// args:
+//     0    1  2   3 4
+//     self fb src x y *, crop
+STATIC mp_obj_jpegdec_t *jpegdec_begin(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args, bool *started) {
+    mp_obj_jpegdec_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+    mp_obj_t fb_in = mp_obj_cast_to_native_base(pos_args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (fb_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *fb = framebuf_follow(MP_OBJ_TO_PTR(fb_in));
+    mp_arg_val_t args[MP_ARRAY_SIZE(jpg_allowed_args)];
+    mp_arg_parse_all(n_args - 2, pos_args + 2, kw_args, MP_ARRAY_SIZE(jpg_allowed_args), jpg_allowed_args, args);
+    mp_int_t crop[4];
+
+    *started = jpg_start(self, fb, args[ARG_jpg_src].u_obj, args[ARG_jpg_x].u_int, args[ARG_jpg_y].u_int, jpg_get_crop(args[ARG_jpg_crop].u_obj, crop), JPG_ARG_DITHER(args));
+    return self;
+}
+
+STATIC mp_obj_t jpegdec_size(mp_obj_jpegdec_t *self) {
+    mp_obj_t value[2];
+    value[0] = mp_obj_new_int(self->jdec.width);
+    value[1] = mp_obj_new_int(self->jdec.height);
+    return mp_obj_new_tuple(2, value);
+}
+
+STATIC mp_obj_t jpegdec_decode(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    bool started;
+    mp_obj_jpegdec_t *self = jpegdec_begin(n_args, pos_args, kw_args, &started);
+
+    if (started) {
+        jpg_finish(self);
+    }
+    return jpegdec_size(self);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(jpegdec_decode_obj, 3, jpegdec_decode);
+
+// Same arguments as decode(), the image is then decoded by step()
+STATIC mp_obj_t jpegdec_start(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    bool started;
+    mp_obj_jpegdec_t *self = jpegdec_begin(n_args, pos_args, kw_args, &started);
+    return jpegdec_size(self);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(jpegdec_start_obj, 3, jpegdec_start);
+
+// Decodes up to n_mcu MCUs (all if 0) and returns the number of MCUs left,
+// so that an asyncio task can yield between calls until it returns 0
+STATIC mp_obj_t jpegdec_step(size_t n_args, const mp_obj_t *args_in) {
+    mp_obj_jpegdec_t *self = MP_OBJ_TO_PTR(args_in[0]);
+    mp_int_t n_mcu = n_args >= 2 ? mp_obj_get_int(args_in[1]) : 0;
+    if (n_mcu < 0) {
+        mp_raise_ValueError(NULL);
+    }
+    return mp_obj_new_int(jpg_step(self, n_mcu));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(jpegdec_step_obj, 1, 2, jpegdec_step);
+
+// Abandons an unfinished decode and closes its source
+STATIC mp_obj_t jpegdec_close(mp_obj_t self_in) {
+    mp_obj_jpegdec_t *self = MP_OBJ_TO_PTR(self_in);
+    jpg_close(self);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(jpegdec_close_obj, jpegdec_close);
+
+// jpg_info(src) returns (width, height, components, mcu_width, mcu_height,
+// restart_interval) from the headers, without allocating or decoding
+STATIC mp_obj_t framebuf_jpg_info(mp_obj_t src) {
+    JDEC jd;
+    jpg_probe(&jd, src);
+
+    mp_obj_t value[6];
+    value[0] = mp_obj_new_int(jd.width);
+    value[1] = mp_obj_new_int(jd.height);
+    value[2] = mp_obj_new_int(jd.ncomp);
+    value[3] = mp_obj_new_int(jd.msx * 8);
+    value[4] = mp_obj_new_int(jd.msy * 8);
+    value[5] = mp_obj_new_int(jd.nrst);
+    return mp_obj_new_tuple(6, value);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(framebuf_jpg_info_obj, framebuf_jpg_info);
+
+#if !MICROPY_ENABLE_DYNRUNTIME
+STATIC const mp_rom_map_elem_t jpegdec_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_decode), MP_ROM_PTR(&jpegdec_decode_obj) },
+    { MP_ROM_QSTR(MP_QSTR_start), MP_ROM_PTR(&jpegdec_start_obj) },
+    { MP_ROM_QSTR(MP_QSTR_step), MP_ROM_PTR(&jpegdec_step_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&jpegdec_close_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(jpegdec_locals_dict, jpegdec_locals_dict_table);
+
+#ifdef MP_OBJ_TYPE_GET_SLOT
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_type_jpegdec,
+    MP_QSTR_JpegDecoder,
+    MP_TYPE_FLAG_NONE,
+    make_new, jpegdec_make_new,
+    locals_dict, (mp_obj_dict_t *)&jpegdec_locals_dict
+);
+#else
+STATIC const mp_obj_type_t mp_type_jpegdec = {
+    { &mp_type_type },
+    .name = MP_QSTR_JpegDecoder,
+    .make_new = jpegdec_make_new,
+    .locals_dict = (mp_obj_dict_t *)&jpegdec_locals_dict,
+};
+#endif
+#endif // !MICROPY_ENABLE_DYNRUNTIME
+#endif // SUPPORT_JPG
+
+#if SUPPORT_PNG
+// PNG decoder state, the rows are converted through a LUT for palette and gray images
+typedef struct {
+    PNGDEC png; /* first, the output function gets it back from the PNGDEC */
+    IODEV dev;
+    color_converts_t convert;
+    uint32_t lut[256]; /* Native colour of each palette index or gray level (high byte) */
+    uint8_t mask[32]; /* Bit set for each transparent palette index or gray level */
+    uint8_t *opaque; /* Optional: bit set for each pixel drawn, rows of (width + 7) / 8 bytes */
+} png_ctx_t;
+
+STATIC size_t png_in_func(PNGDEC *png, uint8_t *buf, size_t len) {
+    return img_read((IODEV *)png->device, buf, len);
+}
+
+STATIC size_t png_in_ref(PNGDEC *png, const uint8_t **ptr, size_t len) {
+    return img_ref((IODEV *)png->device, ptr, len);
+}
+
+STATIC void png_make_lut(png_ctx_t *ctx) {
+    PNGDEC *png = &ctx->png;
+    const mp_obj_framebuf_t *fb = ctx->dev.fb;
+    memset(ctx->mask, 0, sizeof(ctx->mask));
+
+    if (png->color_type == PNG_PALETTE) {
+        for (unsigned int i = 0; i < 256; i++) {
+            const uint8_t *p = &png->palette[i * 4];
+            ctx->lut[i] = ctx->convert(fb, p[0], p[1], p[2]);
+            if (p[3] < 128) {
+                ctx->mask[i >> 3] |= 1 << (i & 7);
+            }
+        }
+    } else if (png->color_type == PNG_GRAY || png->color_type == PNG_GRAY_ALPHA) {
+        // 16-bit samples are looked up by their high byte
+        unsigned int levels = png->depth >= 8 ? 256 : 1 << png->depth;
+        for (unsigned int i = 0; i < levels; i++) {
+            uint8_t g = i * 255 / (levels - 1);
+            ctx->lut[i] = ctx->convert(fb, g, g, g);
+        }
+        if (png->has_trns && png->depth <= 8 && png->trns[0] < levels) {
+            ctx->mask[png->trns[0] >> 3] |= 1 << (png->trns[0] & 7);
+        }
+    }
+}
+
+// Writes the visible pixels of an image row, transparent ones are skipped
+STATIC int png_out(PNGDEC *png, const uint8_t *row, uint32_t y, uint32_t x, uint32_t dx, uint32_t n) {
+    png_ctx_t *ctx = (png_ctx_t *)png;
+    IODEV *dev = &ctx->dev;
+    const mp_obj_framebuf_t *fb = dev->fb;
+    mp_int_t yy = dev->y + y;
+
+    if (yy >= fb->clip_y1) {
+        return png->interlace; // the following rows are all below, until the next pass
+    }
+    if (yy < fb->clip_y0) {
+        return 1;
+    }
+
+    // pixels [i0, i1) of the row are inside the clip window
+    mp_int_t x0 = dev->x + x;
+    uint32_t i0 = x0 < fb->clip_x0 ? (fb->clip_x0 - x0 + dx - 1) / dx : 0;
+    uint32_t i1 = x0 < fb->clip_x1 ? MIN(n, (fb->clip_x1 - x0 + dx - 1) / dx) : 0;
+    unsigned int depth = png->depth;
+    unsigned int s = depth / 8; // bytes per sample, 0 for packed samples
+
+    for (uint32_t i = i0; i < i1; i++) {
+        unsigned int xx = x0 + i * dx;
+        const uint8_t *p;
+        unsigned int v;
+        uint32_t col;
+
+        switch (png->color_type) {
+            case PNG_GRAY:
+            case PNG_PALETTE:
+                if (depth < 8) {
+                    unsigned int bit = i * depth;
+                    v = (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+                } else if (depth == 8) {
+                    v = row[i];
+                } else {
+                    v = row[i * 2];
+                    if (png->has_trns && ((v << 8) | row[i * 2 + 1]) == png->trns[0]) {
+                        continue;
+                    }
+                }
+                if (ctx->mask[v >> 3] & (1 << (v & 7))) {
+                    continue;
+                }
+                col = ctx->lut[v];
+                break;
+            case PNG_GRAY_ALPHA:
+                p = row + i * 2 * s;
+                if (p[s] < 128) {
+                    continue;
+                }
+                col = ctx->lut[p[0]];
+                break;
+            case PNG_RGB:
+                p = row + i * 3 * s;
+                if (png->has_trns) {
+                    if (s == 1 && p[0] == png->trns[0] && p[1] == png->trns[1] && p[2] == png->trns[2]) {
+                        continue;
+                    }
+                    if (s == 2 && ((p[0] << 8) | p[1]) == png->trns[0] && ((p[2] << 8) | p[3]) == png->trns[1] && ((p[4] << 8) | p[5]) == png->trns[2]) {
+                        continue;
+                    }
+                }
+                col = ctx->convert(fb, p[0], p[s], p[2 * s]);
+                break;
+            default: // PNG_RGBA
+                p = row + i * 4 * s;
+                if (p[3 * s] < 128) {
+                    continue;
+                }
+                col = ctx->convert(fb, p[0], p[s], p[2 * s]);
+                break;
+        }
+        setpixel(fb, xx, yy, col);
+        if (ctx->opaque != NULL) {
+            ctx->opaque[yy * ((fb->width + 7) / 8) + (xx >> 3)] |= 1 << (xx & 7);
+        }
+    }
+
+    return 1;
+}
+
+// png(src[, x, y]) draws a PNG file or buffer at x, y and returns (width, height)
+STATIC mp_obj_t framebuf_png(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    mp_int_t x = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_int_t y = n_args > 3 ? mp_obj_get_int(args[3]) : 0;
+
+    #if SUPPORT_IMG_CACHE
+    img_cache_key_t key;
+    img_cache_entry_t *e = NULL;
+    if (img_cache.budget > 0) {
+        img_cache_key(&key, IMG_CACHE_PNG, args[1], self, NULL, 0);
+        e = img_cache_get(&key);
+        if (e != NULL) {
+            img_cache_blit(self, e, x, y);
+            mp_obj_t value[2];
+            value[0] = mp_obj_new_int(e->width);
+            value[1] = mp_obj_new_int(e->height);
+            mp_obj_t ret = mp_obj_new_tuple(2, value);
+            record_call(self, DL_PNG, n_args, args, NULL, ret);
+            return ret;
+        }
+    }
+    #endif
+
+    png_ctx_t *ctx = m_new_obj(png_ctx_t);
+    memset(ctx, 0, sizeof(*ctx));
+    PNGDEC *png = &ctx->png;
+    IODEV *dev = &ctx->dev;
+    dev->blk_size = IMG_FILE_BUF;
+    img_open(dev, args[1]);
+    dev->fb = self;
+    dev->x = x;
+    dev->y = y;
+    png->input = png_in_func;
+    png->inref = png_in_ref;
+    png->device = dev;
+
+    PNGRESULT res = png_prepare(png);
+    const char *func = "png_prepare";
+    if (res == PNG_OK) {
+        ctx->convert = converts[self->format];
+        png_make_lut(ctx);
+        damage_add(self, x, y, png->width, png->height);
+        #if SUPPORT_IMG_CACHE
+        // decode the whole image into a new entry, with a mask if it has transparent pixels
+        if (img_cache.budget > 0) {
+            bool masked = png->has_trns || png->color_type == PNG_GRAY_ALPHA || png->color_type == PNG_RGBA;
+            e = img_cache_new(&key, png->width, png->height, masked);
+        }
+        if (e != NULL) {
+            dev->fb = &e->fb;
+            dev->x = 0;
+            dev->y = 0;
+            ctx->opaque = e->mask;
+        }
+        #endif
+        size_t sz_work = png_work_size(png);
+        uint8_t *work = m_malloc_maybe(sz_work);
+        func = "png_decode";
+        res = work ? png_decode(png, png_out, work) : PNG_MEM;
+        if (res == PNG_INTR) {
+            res = PNG_OK; // stopped below the frame buffer
+        }
+        m_del(uint8_t, work, sz_work);
+    }
+    img_close(dev);
+    m_del(uint8_t, dev->blk, dev->blk_size);
+    if (res != PNG_OK) {
+        m_del_obj(png_ctx_t, ctx);
+        mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(%s)"), png_errors[res], func);
+    }
+    #if SUPPORT_IMG_CACHE
+    if (e != NULL) {
+        e->width = png->width;
+        e->height = png->height;
+        img_cache_add(e);
+        img_cache_blit(self, e, x, y);
+    }
+    #endif
+
+    mp_obj_t value[2];
+    value[0] = mp_obj_new_int(png->width);
+    value[1] = mp_obj_new_int(png->height);
+    m_del_obj(png_ctx_t, ctx);
+    mp_obj_t ret = mp_obj_new_tuple(2, value);
+    record_call(self, DL_PNG, n_args, args, NULL, ret);
+    return ret;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_png_obj, 2, 4, framebuf_png);
+#endif // SUPPORT_PNG
+
+#if SUPPORT_RAW
+#define IMG_NO_FORMAT (0xff)
+
+typedef struct _img_rows_t img_rows_t;
+
+// Draws the visible pixels [i0, i1) of the source row (or MVLSB page) at image row y
+typedef void (*row_draw_t)(const img_rows_t *ir, const uint8_t *row, mp_int_t y);
+
+// Row by row loader of uncompressed images
+struct _img_rows_t {
+    IODEV dev;
+    mp_int_t w, h; /* Image size */
+    mp_int_t i0, i1; /* Visible pixels of each row */
+    size_t row_bytes; /* Bytes per source row, padding included */
+    mp_int_t stride; /* Stride of the source rows in the format */
+    uint8_t format; /* Format of the source rows, IMG_NO_FORMAT if none */
+    uint8_t depth; /* Bits per pixel for the other draw functions */
+    bool bottom_up; /* BMP rows are stored from the bottom */
+    bool invert; /* Rows read straight into the frame buffer are inverted (PBM) */
+    uint16_t maxval; /* Largest PGM sample */
+    row_draw_t draw;
+    uint32_t lut[256]; /* Native colour of each palette index or gray level */
+};
+
+// Rows in a frame buffer format, through getpixel of a frame buffer over the row
+STATIC void row_native(const img_rows_t *ir, const uint8_t *row, mp_int_t y) {
+    const mp_obj_framebuf_t *fb = ir->dev.fb;
+    mp_obj_framebuf_t src = {
+        .buf = (void *)row,
+        .width = ir->w,
+        .height = 8,
+        .stride = ir->stride,
+        .format = ir->format,
+    };
+    mp_int_t band = ir->format == FRAMEBUF_MVLSB ? 8 : 1;
+    bool same = format_bpp[ir->format] == format_bpp[fb->format];
+
+    for (mp_int_t yy = 0; yy < band && y + yy < ir->h; yy++) {
+        mp_int_t fy = ir->dev.y + y + yy;
+        if (fy < fb->clip_y0 || fy >= fb->clip_y1) {
+            continue;
+        }
+        for (mp_int_t i = ir->i0; i < ir->i1; i++) {
+            uint32_t col = getpixel(&src, i, yy);
+            if (!same) {
+                uint8_t rgb[3];
+                native_to_rgb888(ir->format, col, rgb);
+                col = img_color(fb, rgb[0], rgb[1], rgb[2]);
+            }
+            setpixel(fb, ir->dev.x + i, fy, col);
+        }
+    }
+}
+
+// Palette indices or gray levels packed MSB first, 16-bit gray is big endian
+STATIC void row_lut(const img_rows_t *ir, const uint8_t *row, mp_int_t y) {
+    const mp_obj_framebuf_t *fb = ir->dev.fb;
+    unsigned int depth = ir->depth;
+
+    for (mp_int_t i = ir->i0; i < ir->i1; i++) {
+        unsigned int v;
+        if (depth == 16) {
+            v = (row[i * 2] << 8) | row[i * 2 + 1];
+            v = MIN(v, ir->maxval) * 255 / ir->maxval;
+        } else {
+            unsigned int bit = i * depth;
+            v = (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+        }
+        setpixel(fb, ir->dev.x + i, ir->dev.y + y, ir->lut[v]);
+    }
+}
+
+// BMP 24-bit BGR and 32-bit BGRX
+STATIC void row_bgr(const img_rows_t *ir, const uint8_t *row, mp_int_t y) {
+    const mp_obj_framebuf_t *fb = ir->dev.fb;
+    unsigned int n = ir->depth / 8;
+
+    for (mp_int_t i = ir->i0; i < ir->i1; i++) {
+        const uint8_t *p = row + i * n;
+        setpixel(fb, ir->dev.x + i, ir->dev.y + y, img_color(fb, p[2], p[1], p[0]));
+    }
+}
+
+// BMP 16-bit little endian, RGB555 (depth 15) or RGB565
+STATIC void row_bmp16(const img_rows_t *ir, const uint8_t *row, mp_int_t y) {
+    const mp_obj_framebuf_t *fb = ir->dev.fb;
+
+    for (mp_int_t i = ir->i0; i < ir->i1; i++) {
+        unsigned int v = row[i * 2] | (row[i * 2 + 1] << 8);
+        uint8_t r, g, b;
+        if (ir->depth == 16) {
+            r = (v >> 8) & 0xf8;
+            g = (v >> 3) & 0xfc;
+            g |= g >> 6;
+        } else {
+            r = (v >> 7) & 0xf8;
+            g = (v >> 2) & 0xf8;
+            g |= g >> 5;
+        }
+        b = (v << 3) & 0xf8;
+        setpixel(fb, ir->dev.x + i, ir->dev.y + y, img_color(fb, r | r >> 5, g, b | b >> 5));
+    }
+}
+
+// Reads the rows and draws the visible ones. When the rows are in the format
+// of the frame buffer and their bits line up with it, they are read straight
+// into the frame buffer, with a single read when whole rows are visible.
+STATIC mp_rom_error_text_t img_load_rows(img_rows_t *ir) {
+    IODEV *dev = &ir->dev;
+    const mp_obj_framebuf_t *fb = dev->fb;
+    mp_int_t band = ir->format == FRAMEBUF_MVLSB ? 8 : 1;
+    mp_int_t nrows = (ir->h + band - 1) / band;
+
+    // visible pixels of a row and visible rows (or pages)
+    ir->i0 = MAX(0, fb->clip_x0 - dev->x);
+    ir->i1 = MIN(ir->w, fb->clip_x1 - dev->x);
+    mp_int_t r0 = MAX(0, fb->clip_y0 - dev->y) / band;
+    mp_int_t r1 = (MIN(ir->h, fb->clip_y1 - dev->y) + band - 1) / band;
+    if (ir->i0 >= ir->i1 || r0 >= r1) {
+        return NULL;
+    }
+
+    unsigned int bpp = format_bpp[fb->format];
+    bool direct = ir->format == fb->format && band == 1 && !fb->rotate
+        && ir->i0 * bpp % 8 == 0 && (dev->x + ir->i0 + fb->xoff) * bpp % 8 == 0
+        && ((ir->i1 - ir->i0) * bpp % 8 == 0 || (dev->x + ir->i1 == fb->width && !fb->view));
+    size_t fb_row = framebuf_row_bytes(fb->format, fb->stride);
+    size_t lead = ir->i0 * bpp / 8;
+    size_t n = ((ir->i1 - ir->i0) * bpp + 7) / 8;
+    size_t trail = ir->row_bytes - lead - n;
+    uint8_t *dst = (uint8_t *)fb->buf + (dev->x + ir->i0 + fb->xoff) * bpp / 8;
+
+    size_t skip = (ir->bottom_up ? nrows - r1 : r0) * ir->row_bytes;
+    if (img_read(dev, NULL, skip) != skip) {
+        return MP_ERROR_TEXT("image data too short");
+    }
+
+    if (direct && !ir->bottom_up && n == ir->row_bytes && n == fb_row) {
+        n *= r1 - r0;
+        dst += (dev->y + r0) * fb_row;
+        if (img_read(dev, dst, n) != n) {
+            return MP_ERROR_TEXT("image data too short");
+        }
+        for (size_t j = 0; ir->invert && j < n; j++) {
+            dst[j] = ~dst[j];
+        }
+        return NULL;
+    }
+
+    uint8_t *rowbuf = NULL;
+    mp_int_t k;
+    for (k = 0; k < r1 - r0; k++) {
+        mp_int_t r = ir->bottom_up ? r1 - 1 - k : r0 + k;
+
+        if (direct) {
+            uint8_t *p = dst + (dev->y + r) * fb_row;
+            if (img_read(dev, NULL, lead) != lead || img_read(dev, p, n) != n || img_read(dev, NULL, trail) != trail) {
+                break;
+            }
+            for (size_t j = 0; ir->invert && j < n; j++) {
+                p[j] = ~p[j];
+            }
+            continue;
+        }
+
+        // rows are used in place when they are all in the buffer or the file block
+        const uint8_t *row;
+        unsigned int got = img_ref(dev, &row, ir->row_bytes);
+        if (got < ir->row_bytes) {
+            if (rowbuf == NULL) {
+                rowbuf = m_new(uint8_t, ir->row_bytes);
+            }
+            memcpy(rowbuf, row, got);
+            if (img_read(dev, rowbuf + got, ir->row_bytes - got) != ir->row_bytes - got) {
+                break;
+            }
+            row = rowbuf;
+        }
+        ir->draw(ir, row, r * band);
+    }
+    m_del(uint8_t, rowbuf, ir->row_bytes);
+
+    return k < r1 - r0 ? MP_ERROR_TEXT("image data too short") : NULL;
+}
+
+STATIC uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Reads the BMP headers and palette, the stream is left at the pixel data.
+// Uncompressed 1, 4, 8, 16, 24 and 32-bit images are supported.
+STATIC mp_rom_error_text_t bmp_prepare(img_rows_t *ir) {
+    IODEV *dev = &ir->dev;
+    uint8_t d[14 + 124];
+
+    // file header and the size of the info header
+    if (img_read(dev, d, 18) != 18 || d[0] != 'B' || d[1] != 'M') {
+        return MP_ERROR_TEXT("invalid bmp");
+    }
+    uint32_t offbits = get_le32(d + 10);
+    uint32_t hsize = get_le32(d + 14);
+    if (hsize < 40 || hsize > 124 || img_read(dev, d + 18, hsize - 4) != hsize - 4) {
+        return MP_ERROR_TEXT("unsupported bmp");
+    }
+    uint32_t pos = 14 + hsize;
+
+    int32_t w = get_le32(d + 18);
+    int32_t h = get_le32(d + 22);
+    unsigned int bits = d[28] | (d[29] << 8);
+    uint32_t compression = get_le32(d + 30);
+    uint32_t ncolors = get_le32(d + 46);
+    if (w <= 0 || w > 0xffff || h == 0 || h < -0xffff || h > 0xffff) {
+        return MP_ERROR_TEXT("invalid bmp");
+    }
+    ir->w = w;
+    ir->h = h < 0 ? -h : h;
+    ir->bottom_up = h > 0;
+    ir->row_bytes = ((size_t)w * bits + 31) / 32 * 4;
+    ir->depth = bits;
+
+    // colour masks of BI_BITFIELDS follow a 40-byte header, or are in the
+    // header from the 52-byte V2 one on
+    uint32_t masks[3] = {0, 0, 0};
+    if (compression == 3) {
+        if (hsize == 40) {
+            if (img_read(dev, d + 54, 12) != 12) {
+                return MP_ERROR_TEXT("invalid bmp");
+            }
+            pos += 12;
+        } else if (hsize < 52) {
+            return MP_ERROR_TEXT("invalid bmp");
+        }
+        for (int i = 0; i < 3; i++) {
+            masks[i] = get_le32(d + 54 + i * 4);
+        }
+    } else if (compression != 0) {
+        return MP_ERROR_TEXT("unsupported bmp");
+    }
+
+    const mp_obj_framebuf_t *fb = dev->fb;
+    ir->format = IMG_NO_FORMAT;
+    switch (bits) {
+        case 1:
+        case 4:
+        case 8: {
+            if (compression != 0) {
+                return MP_ERROR_TEXT("unsupported bmp");
+            }
+            unsigned int levels = 1 << bits;
+            ncolors = ncolors ? ncolors : levels;
+            if (ncolors > levels) {
+                return MP_ERROR_TEXT("invalid bmp");
+            }
+            // palette of BGRX entries, a gray ramp can be read straight into the same gray format
+            bool ramp = true, inverse = bits == 1;
+            memset(ir->lut, 0, sizeof(ir->lut));
+            for (unsigned int i = 0; i < ncolors; i++) {
+                if (img_read(dev, d, 4) != 4) {
+                    return MP_ERROR_TEXT("invalid bmp");
+                }
+                uint8_t g = i * 255 / (levels - 1);
+                ramp = ramp && d[0] == g && d[1] == g && d[2] == g;
+                inverse = inverse && d[0] == 255 - g && d[1] == 255 - g && d[2] == 255 - g;
+                ir->lut[i] = img_color(fb, d[2], d[1], d[0]);
+            }
+            pos += ncolors * 4;
+            if (ncolors == levels && (ramp || inverse)) {
+                ir->format = bits == 1 ? FRAMEBUF_MHLSB : bits == 4 ? FRAMEBUF_GS4_HMSB : FRAMEBUF_GS8;
+                ir->invert = inverse;
+            }
+            ir->draw = row_lut;
+            break;
+        }
+        case 16:
+            if (compression == 0 || (masks[0] == 0x7c00 && masks[1] == 0x03e0 && masks[2] == 0x001f)) {
+                ir->depth = 15;
+            } else if (masks[0] == 0xf800 && masks[1] == 0x07e0 && masks[2] == 0x001f) {
+                #if MP_ENDIANNESS_LITTLE
+                ir->format = FRAMEBUF_RGB565;
+                #endif
+            } else {
+                return MP_ERROR_TEXT("unsupported bmp");
+            }
+            ir->draw = row_bmp16;
+            break;
+        case 24:
+        case 32:
+            if (compression == 3 && (masks[0] != 0xff0000 || masks[1] != 0xff00 || masks[2] != 0xff)) {
+                return MP_ERROR_TEXT("unsupported bmp");
+            }
+            if (bits == 24) {
+                ir->format = FRAMEBUF_RGB888; // stored as BGR, like the frame buffer
+            }
+            ir->draw = row_bgr;
+            break;
+        default:
+            return MP_ERROR_TEXT("unsupported bmp");
+    }
+
+    if (offbits < pos || img_read(dev, NULL, offbits - pos) != offbits - pos) {
+        return MP_ERROR_TEXT("invalid bmp");
+    }
+    return NULL;
+}
+
+// Reads a number of the PNM header, skipping white space and comments,
+// and the white space character after it
+STATIC bool pnm_int(IODEV *dev, unsigned int *val) {
+    uint8_t c;
 
-// file input function
-STATIC unsigned int file_in_func(JDEC *jd, uint8_t *buff, unsigned int nbyte) {
-    IODEV *dev = (IODEV *)jd->device;
-    unsigned int nread;
-    int errcode;
+    do {
+        if (img_read(dev, &c, 1) != 1) {
+            return false;
+        }
+        while (c == '#') {
+            do {
+                if (img_read(dev, &c, 1) != 1) {
+                    return false;
+                }
+            } while (c != '\n');
+        }
+    } while (unichar_isspace(c));
 
-    if (buff) { // Read data from input stream
-        nread = (unsigned int)mp_stream_rw(dev->fp, buff, nbyte, &errcode, MP_STREAM_RW_READ);
-        return nread;
+    *val = 0;
+    while (unichar_isdigit(c)) {
+        *val = *val * 10 + c - '0';
+        if (*val > 0xffff || img_read(dev, &c, 1) != 1) {
+            return false;
+        }
     }
+    return unichar_isspace(c);
+}
 
-    // Remove data from input stream if buff was NULL
-    // mp_seek(dev->fp, nbyte, SEEK_CUR);
-    return 0;
+// Reads the header of a binary PGM (P5) or PBM (P4) image
+STATIC mp_rom_error_text_t pnm_prepare(img_rows_t *ir) {
+    IODEV *dev = &ir->dev;
+    const mp_obj_framebuf_t *fb = dev->fb;
+    uint8_t magic[2];
+    unsigned int w, h, maxval = 1;
+
+    if (img_read(dev, magic, 2) != 2 || magic[0] != 'P' || (magic[1] != '4' && magic[1] != '5')) {
+        return MP_ERROR_TEXT("unsupported pgm");
+    }
+    if (!pnm_int(dev, &w) || !pnm_int(dev, &h) || (magic[1] == '5' && !pnm_int(dev, &maxval))) {
+        return MP_ERROR_TEXT("invalid pgm");
+    }
+    if (w == 0 || h == 0 || maxval == 0) {
+        return MP_ERROR_TEXT("invalid pgm");
+    }
+    ir->w = w;
+    ir->h = h;
+    ir->maxval = maxval;
+    ir->depth = magic[1] == '4' ? 1 : maxval > 255 ? 16 : 8;
+    ir->row_bytes = ((size_t)w * ir->depth + 7) / 8;
+    ir->draw = row_lut;
+
+    if (ir->depth == 1) {
+        // PBM stores black as 1
+        ir->lut[0] = img_color(fb, 255, 255, 255);
+        ir->lut[1] = img_color(fb, 0, 0, 0);
+        ir->format = FRAMEBUF_MHLSB;
+        ir->invert = true;
+    } else {
+        // gray levels of 8-bit samples, or of 16-bit samples scaled to 8 bits
+        unsigned int levels = ir->depth == 8 ? maxval : 255;
+        for (unsigned int i = 0; i < 256; i++) {
+            uint8_t g = MIN(i, levels) * 255 / levels;
+            ir->lut[i] = img_color(fb, g, g, g);
+        }
+        ir->format = maxval == 255 ? FRAMEBUF_GS8 : IMG_NO_FORMAT;
+    }
+    return NULL;
 }
 
-STATIC int out_fast(JDEC *jd, void *bitmap, JRECT *rect) {
-#if 0
-    IODEV *dev = (IODEV *)jd->device;
-    uint8_t *bitmap_ptr = (uint8_t *)bitmap;
-    uint16_t x_offs = dev->x_offs;
-    uint16_t y_offs = dev->y_offs;
-    uint16_t x = 0;
-    uint16_t y = 0;
-
-    mp_printf(&mp_plat_print, "out_fast top: %d, bottom: %d, left: %d, right: %d\n",
-        rect->top,
-        rect->bottom,
-        rect->left,
-        rect->right
-    );
-
-    for (y = rect->top; y <= rect->bottom; y++) {
-        for (x = rect->left; x <= rect->right; x++) {
-            uint8_t r = *(bitmap_ptr++);
-            uint8_t g = *(bitmap_ptr++);
-            uint8_t b = *(bitmap_ptr++);
-            uint32_t gamme_val = (r * 38 + g * 75 + b * 15) >> 7;
-            // setpixel_checked(
-            //     dev->framebuf_obj,
-            //     x_offs + x,
-            //     y_offs + y,
-            //     (gs8_curve[gamme_val] >> 4),
-            //     1
-            // );
+typedef mp_rom_error_text_t (*img_prepare_t)(img_rows_t *ir);
+
+// Opens src, reads its header with prepare and draws the image at x, y
+STATIC void img_load(img_rows_t *ir, const mp_obj_framebuf_t *fb, mp_obj_t src, mp_int_t x, mp_int_t y, img_prepare_t prepare) {
+    IODEV *dev = &ir->dev;
+
+    // rows of a block or more are read straight into the frame buffer
+    dev->blk_size = IMG_FILE_ALIGN;
+    img_open(dev, src);
+    dev->fb = fb;
+    dev->x = x;
+    dev->y = y;
+
+    mp_rom_error_text_t err = prepare ? prepare(ir) : NULL;
+    if (err == NULL) {
+        damage_add(fb, x, y, ir->w, ir->h);
+        if (fb->tone != NULL && ir->draw == row_lut) {
+            // gray levels go through the lut, which has the tone curve
+            ir->format = IMG_NO_FORMAT;
         }
+        err = img_load_rows(ir);
     }
-#endif
+    img_close(dev);
+    m_del(uint8_t, dev->blk, dev->blk_size);
+    if (err) {
+        mp_raise_msg(&mp_type_RuntimeError, err);
+    }
+}
+
+// load_raw(src, x, y, w, h, format) draws an image stored as the buffer of a w x h FrameBuffer of format
+STATIC mp_obj_t framebuf_load_raw(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    mp_int_t w = mp_obj_get_int(args[4]);
+    mp_int_t h = mp_obj_get_int(args[5]);
+    mp_int_t format = mp_obj_get_int(args[6]);
+
+    if (w <= 0 || h <= 0 || format < 0 || format >= (mp_int_t)MP_ARRAY_SIZE(format_bpp)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid raw image"));
+    }
+    img_rows_t *ir = m_new_obj(img_rows_t);
+    memset(ir, 0, sizeof(*ir));
+    ir->w = w;
+    ir->h = h;
+    ir->format = format;
+    ir->stride = framebuf_stride(format, w);
+    ir->row_bytes = framebuf_row_bytes(format, ir->stride);
+    ir->draw = row_native;
+    img_load(ir, self, args[1], mp_obj_get_int(args[2]), mp_obj_get_int(args[3]), NULL);
+    m_del_obj(img_rows_t, ir);
+    record_call(self, DL_LOAD_RAW, n_args, args, NULL, MP_OBJ_NULL);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_load_raw_obj, 7, 7, framebuf_load_raw);
+
+STATIC mp_obj_t framebuf_load_image(size_t n_args, const mp_obj_t *args, img_prepare_t prepare) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    mp_int_t x = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_int_t y = n_args > 3 ? mp_obj_get_int(args[3]) : 0;
+
+    img_rows_t *ir = m_new_obj(img_rows_t);
+    memset(ir, 0, sizeof(*ir));
+    img_load(ir, self, args[1], x, y, prepare);
+
+    mp_obj_t value[2];
+    value[0] = mp_obj_new_int(ir->w);
+    value[1] = mp_obj_new_int(ir->h);
+    m_del_obj(img_rows_t, ir);
+    return mp_obj_new_tuple(2, value);
+}
 
-    IODEV *dev = (IODEV*)jd->device;   /* Session identifier (5th argument of jd_prepare function) */
-    uint8_t *src, *dst;
-    uint16_t y, bws;
-    unsigned int bwd;
+// bmp(src[, x, y]) draws a BMP file or buffer at x, y and returns (width, height)
+STATIC mp_obj_t framebuf_bmp(size_t n_args, const mp_obj_t *args) {
+    mp_obj_t ret = framebuf_load_image(n_args, args, bmp_prepare);
+    record_call(MP_OBJ_TO_PTR(args[0]), DL_BMP, n_args, args, NULL, ret);
+    return ret;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_bmp_obj, 2, 4, framebuf_bmp);
+
+// pgm(src[, x, y]) draws a binary PGM or PBM file or buffer at x, y and returns (width, height)
+STATIC mp_obj_t framebuf_pgm(size_t n_args, const mp_obj_t *args) {
+    mp_obj_t ret = framebuf_load_image(n_args, args, pnm_prepare);
+    record_call(MP_OBJ_TO_PTR(args[0]), DL_PGM, n_args, args, NULL, ret);
+    return ret;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_pgm_obj, 2, 4, framebuf_pgm);
+#endif // SUPPORT_RAW
 
-    /* Progress indicator */
-    if (rect->left == 0) {
-        printf("\r%lu%%", (rect->top << jd->scale) * 100UL / jd->height);
+#if SUPPORT_SAVE || SUPPORT_DISPLAY_LIST
+// Output of save_pgm(), save_png() and DisplayList.render(), a file opened by name or a stream object
+typedef struct {
+    mp_obj_t stream;
+    bool opened; /* the file was opened by img_out_open */
+    int errcode; /* error of the first failed write */
+} img_out_t;
+
+STATIC void img_out_open(img_out_t *out, mp_obj_t dst) {
+    out->errcode = 0;
+    out->opened = mp_obj_is_str(dst);
+    if (out->opened) {
+        mp_obj_t vfs_args[2] = {
+            dst,
+            MP_OBJ_NEW_QSTR(MP_QSTR_wb),
+        };
+        dst = mp_vfs_open(MP_ARRAY_SIZE(vfs_args), &vfs_args[0], (mp_map_t *)&mp_const_empty_map);
+    } else {
+        mp_get_stream_raise(dst, MP_STREAM_OP_WRITE);
     }
+    out->stream = dst;
+}
 
-    /* Copy the output image rectangle to the frame buffer */
-    src = (uint8_t*)bitmap;                           /* Output bitmap */
-    dst = dev->fbuf + 3 * (rect->top * dev->wfbuf + rect->left);  /* Left-top of rectangle in the frame buffer */
-    bws = 3 * (rect->right - rect->left + 1);     /* Width of the rectangle [byte] */
-    bwd = 3 * dev->wfbuf;                         /* Width of the frame buffer [byte] */
-    for (y = rect->top; y <= rect->bottom; y++) {
-        memcpy(dst, src, bws);   /* Copy a line */
-        src += bws; dst += bwd;  /* Next line */
+// Writes len bytes, nothing after a failed write. Returns false on error
+STATIC bool img_out_write(img_out_t *out, const void *buf, size_t len) {
+    if (out->errcode == 0) {
+        int errcode = 0;
+        mp_uint_t n = mp_stream_rw(out->stream, (void *)buf, len, &errcode, MP_STREAM_RW_WRITE);
+        if (n != len) {
+            out->errcode = errcode ? errcode : MP_EIO;
+        }
     }
+    return out->errcode == 0;
+}
 
-    return 1; // Continue to decompress
+// Closes a file opened by name and raises the error of the first failed write
+STATIC void img_out_close(img_out_t *out) {
+    if (out->opened) {
+        mp_stream_close(out->stream);
+    }
+    if (out->errcode) {
+        mp_raise_OSError(out->errcode);
+    }
 }
 
-STATIC mp_obj_t framebuf_jpg(size_t n_args, const mp_obj_t *args_in) {
-    // extract arguments
-    mp_obj_framebuf_t *self = MP_OBJ_TO_PTR(args_in[0]);
-    uint16_t x = 0;
-    uint16_t y = 0;
+#if SUPPORT_DISPLAY_LIST
+// Closes a file opened by name after an exception, any write error is dropped
+STATIC void img_out_abort(img_out_t *out) {
+    if (out->opened) {
+        mp_stream_close(out->stream);
+    }
+}
+#endif
+#endif
 
-    if (n_args >= 4) {
-        y = mp_obj_get_int(args_in[3]);
-        if (y > self->height) {
-            return mp_const_none;
+#if SUPPORT_SAVE
+// Bits per gray level of the gray and mono formats, 0 for the colour ones
+STATIC unsigned int save_depth(uint8_t format) {
+    switch (format) {
+        case FRAMEBUF_RGB565:
+        case FRAMEBUF_RGB888:
+            return 0;
+        case FRAMEBUF_GS8:
+            return 8;
+        case FRAMEBUF_GS4_HMSB:
+        case FRAMEBUF_GS4_HLSB:
+            return 4;
+        case FRAMEBUF_GS2_HMSB:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+// Packs the gray levels of row y MSB first, depth bits each, as PNG gray rows
+// are. With a depth of 8, one level per byte as in PGM files.
+STATIC void save_gray_row(const mp_obj_framebuf_t *fb, mp_int_t y, uint8_t *row, unsigned int depth) {
+    if (fb->format == FRAMEBUF_GS8 && !fb->rotate) {
+        memcpy(row, (uint8_t *)fb->buf + y * fb->stride, fb->width);
+        return;
+    }
+    if (depth == 8) {
+        for (mp_int_t x = 0; x < fb->width; x++) {
+            row[x] = getpixel(fb, x, y);
         }
+        return;
+    }
+    memset(row, 0, (fb->width * depth + 7) / 8);
+    for (mp_int_t x = 0; x < fb->width; x++) {
+        unsigned int bit = x * depth;
+        row[bit >> 3] |= getpixel(fb, x, y) << (8 - depth - (bit & 7));
     }
+}
 
-    if (n_args >= 3) {
-        x = mp_obj_get_int(args_in[2]);
-        if (x > self->width) {
-            return mp_const_none;
+// save_pgm(dst) writes the frame buffer to a file or stream as a binary PGM,
+// the gray levels of the format or the luma of colour formats
+STATIC mp_obj_t framebuf_save_pgm(mp_obj_t self_in, mp_obj_t dst_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(self_in));
+    unsigned int depth = save_depth(self->format);
+    uint8_t *row = m_new(uint8_t, self->width);
+    img_out_t out;
+    img_out_open(&out, dst_in);
+
+    char head[32];
+    int n = snprintf(head, sizeof(head), "P5\n%u %u\n%u\n", self->width, self->height, depth ? (1u << depth) - 1 : 255);
+    img_out_write(&out, head, n);
+    for (mp_int_t y = 0; y < self->height && out.errcode == 0; y++) {
+        if (depth) {
+            save_gray_row(self, y, row, 8);
+        } else {
+            uint8_t rgb[3];
+            for (mp_int_t x = 0; x < self->width; x++) {
+                native_to_rgb888(self->format, getpixel(self, x, y), rgb);
+                row[x] = rgb888_to_luma(rgb[0], rgb[1], rgb[2]);
+            }
         }
+        img_out_write(&out, row, self->width);
     }
 
-    mp_buffer_info_t bufinfo;
-    IODEV devid;
-    JRESULT res;
-    JDEC jdec;
-    uint8_t *work = NULL;
-    unsigned int (*input_func)(JDEC*, uint8_t*, unsigned int) = NULL;
+    m_del(uint8_t, row, self->width);
+    img_out_close(&out);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_save_pgm_obj, framebuf_save_pgm);
 
-    if (mp_obj_is_str(args_in[1])) {
-        // const char *filename = mp_obj_str_get_str(args_in[1]);
-        mp_obj_t vfs_args[2] = {
-            args_in[1],
-            MP_OBJ_NEW_QSTR(MP_QSTR_rb),
-        };
-        devid.fp = mp_vfs_open(MP_ARRAY_SIZE(vfs_args), &vfs_args[0], (mp_map_t *)&mp_const_empty_map);
-        devid.data = MP_OBJ_NULL;
-        devid.data_len = 0;
-        input_func = file_in_func;
-    } else if (mp_obj_is_type(args_in[1], &mp_type_bytes)) {
-        mp_get_buffer_raise(args_in[1], &bufinfo, MP_BUFFER_READ);
-        devid.data_index = 0;
-        devid.data = bufinfo.buf;
-        devid.data_len = bufinfo.len;
-        devid.fp = MP_OBJ_NULL;
-        input_func = buffer_in_func;
+#if SUPPORT_PNG
+STATIC int png_enc_output(PNGENC *png, const uint8_t *buf, size_t len) {
+    return img_out_write(png->device, buf, len);
+}
+
+// save_png(dst) writes the frame buffer to a file or stream as a PNG, gray
+// with the depth of gray and mono formats, RGB for colour formats. Rows are
+// converted and deflated one at a time, so memory use doesn't depend on the height.
+STATIC mp_obj_t framebuf_save_png(mp_obj_t self_in, mp_obj_t dst_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(self_in));
+    unsigned int depth = save_depth(self->format);
+    PNGENC *png = m_new_obj(PNGENC);
+    memset(png, 0, sizeof(*png));
+    png->width = self->width;
+    png->height = self->height;
+    png->depth = depth ? depth : 8;
+    png->color_type = depth ? PNG_GRAY : PNG_RGB;
+    png->output = png_enc_output;
+    size_t len = ((size_t)self->width * (depth ? depth : 24) + 7) / 8 + 1;
+    uint8_t *row = m_new(uint8_t, len);
+    img_out_t out;
+    png->device = &out;
+    img_out_open(&out, dst_in);
+
+    PNGRESULT res = png_enc_start(png);
+    for (mp_int_t y = 0; y < self->height && res == PNG_OK; y++) {
+        if (depth) {
+            save_gray_row(self, y, row + 1, depth);
+        } else {
+            for (mp_int_t x = 0; x < self->width; x++) {
+                native_to_rgb888(self->format, getpixel(self, x, y), row + 1 + x * 3);
+            }
+        }
+        res = png_enc_row(png, row);
+    }
+    if (res == PNG_OK) {
+        res = png_enc_finish(png);
     } else {
-        return mp_const_none;
+        png_enc_abort(png);
     }
 
-    work = (uint8_t *)m_malloc(3100);
-    if (work == NULL) {
-        goto OUT_OF_MEMORY;
+    m_del(uint8_t, row, len);
+    m_del_obj(PNGENC, png);
+    img_out_close(&out);
+    if (res != PNG_OK) {
+        mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(png_enc)"), png_errors[res]);
     }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(framebuf_save_png_obj, framebuf_save_png);
+#endif
+#endif // SUPPORT_SAVE
+
+#if SUPPORT_DISPLAY_LIST
+// A DisplayList records drawing calls with their arguments, and replays them
+// into a frame buffer skipping the calls whose bounding box misses its clip
+// window. render() replays it into a strip a band of rows at a time, so that
+// a frame is drawn with a frame buffer of a few rows.
+
+#define DL_ARGS_MAX (12) // positional values and keyword pairs of a recorded call
+
+// Bounding boxes of the calls, from x, y and the arguments after them
+enum {
+    DL_BOX_ALL,     // anywhere, never culled
+    DL_BOX_XYWH,    // x, y, w, h
+    DL_BOX_HLINE,   // x, y, w
+    DL_BOX_VLINE,   // x, y, h
+    DL_BOX_PIXEL,   // x, y
+    DL_BOX_LINE,    // x1, y1, x2, y2
+    DL_BOX_ELLIPSE, // cx, cy, xr, yr
+    DL_BOX_POLY,    // x, y, coords
+    DL_BOX_TEXT,    // s, x, y in 8x8 characters
+    DL_BOX_SRC,     // a frame buffer at x, y
+    DL_BOX_IMAGE,   // the (w, h) returned by the first replay
+    DL_BOX_WRITE,   // s, x, y in the gfx font of the first replay
+};
 
-    res = jd_prepare(&jdec, input_func, work, 3100, &devid);
-    if (res != JDR_OK) {
-        goto OUT_PREPARE;
+// Positional arguments from x that a call of each box must have
+STATIC const uint8_t dl_box_args[] = {
+    [DL_BOX_ALL] = 0,
+    [DL_BOX_XYWH] = 4,
+    [DL_BOX_HLINE] = 3,
+    [DL_BOX_VLINE] = 3,
+    [DL_BOX_PIXEL] = 3, // with the colour, getting a pixel isn't recorded
+    [DL_BOX_LINE] = 4,
+    [DL_BOX_ELLIPSE] = 4,
+    [DL_BOX_POLY] = 3,
+    [DL_BOX_TEXT] = 2,
+    [DL_BOX_SRC] = 0, // x and y default to 0
+    [DL_BOX_IMAGE] = 0,
+    [DL_BOX_WRITE] = 2,
+};
+
+typedef struct {
+    const mp_obj_base_t *fun; // the method, called with the frame buffer first
+    uint8_t box;
+    uint8_t x; // index of the x argument, self being 0, 0 for no coordinates
+    bool kw; // takes keyword arguments
+} dl_op_t;
+
+STATIC const dl_op_t dl_ops[] = {
+    [DL_FILL] = { &framebuf_fill_obj.base, DL_BOX_ALL, 0, false },
+    [DL_FILL_RECT] = { &framebuf_fill_rect_obj.base, DL_BOX_XYWH, 1, false },
+    [DL_PIXEL] = { &framebuf_pixel_obj.base, DL_BOX_PIXEL, 1, false },
+    [DL_HLINE] = { &framebuf_hline_obj.base, DL_BOX_HLINE, 1, false },
+    [DL_VLINE] = { &framebuf_vline_obj.base, DL_BOX_VLINE, 1, false },
+    [DL_RECT] = { &framebuf_rect_obj.base, DL_BOX_XYWH, 1, false },
+    [DL_LINE] = { &framebuf_line_obj.base, DL_BOX_LINE, 1, false },
+    [DL_ELLIPSE] = { &framebuf_ellipse_obj.base, DL_BOX_ELLIPSE, 1, false },
+    #if MICROPY_PY_ARRAY
+    [DL_POLY] = { &framebuf_poly_obj.base, DL_BOX_POLY, 1, false },
+    #endif
+    [DL_TEXT] = { &framebuf_text_obj.base, DL_BOX_TEXT, 2, false },
+    [DL_BLIT] = { &framebuf_blit_obj.base, DL_BOX_SRC, 2, true },
+    [DL_BLIT_SCALED] = { &framebuf_blit_scaled_obj.base, DL_BOX_XYWH, 2, true },
+    #if SUPPORT_DITHER
+    [DL_CONVERT_FROM] = { &framebuf_convert_from_obj.base, DL_BOX_SRC, 2, true },
+    #endif
+    #if SUPPORT_GFX_FONT
+    [DL_WRITE] = { &framebuf_write_obj.base, DL_BOX_WRITE, 2, false },
+    #endif
+    #if SUPPORT_JPG
+    [DL_JPG] = { &framebuf_jpg_obj.base, DL_BOX_IMAGE, 2, true },
+    #endif
+    #if SUPPORT_PNG
+    [DL_PNG] = { &framebuf_png_obj.base, DL_BOX_IMAGE, 2, false },
+    #endif
+    #if SUPPORT_RAW
+    [DL_LOAD_RAW] = { &framebuf_load_raw_obj.base, DL_BOX_XYWH, 2, false },
+    [DL_BMP] = { &framebuf_bmp_obj.base, DL_BOX_IMAGE, 2, false },
+    [DL_PGM] = { &framebuf_pgm_obj.base, DL_BOX_IMAGE, 2, false },
+    #endif
+};
+
+typedef struct {
+    uint8_t op;
+    uint8_t n_args, n_kw; // positional arguments after self, keyword pairs after them
+    uint8_t xi, yi; // indices of the values of x and y in the arguments
+    bool boxed; // false until the box of an image or gfx text is known
+    int32_t x0, y0, x1, y1; // bounding box, ends exclusive
+    size_t arg; // index of the first argument in the pool
+} dl_item_t;
+
+typedef struct _mp_obj_displaylist_t {
+    mp_obj_base_t base;
+    dl_item_t *items;
+    size_t n_items, alloc_items;
+    mp_obj_t *pool; // the arguments of all items
+    size_t n_pool, alloc_pool;
+} mp_obj_displaylist_t;
+
+STATIC void dl_set_box(dl_item_t *it, mp_int_t x0, mp_int_t y0, mp_int_t x1, mp_int_t y1) {
+    it->x0 = x0;
+    it->y0 = y0;
+    it->x1 = x1;
+    it->y1 = y1;
+    it->boxed = true;
+}
+
+// Pixels from v over n, n < 1 covering v + n - 1 to v as the far edge of rect() does
+STATIC void dl_span(mp_int_t v, mp_int_t n, mp_int_t *v0, mp_int_t *v1) {
+    *v0 = MIN(v, v + n - 1);
+    *v1 = MAX(v + n, v + 1);
+}
+
+// Returns the index of the value of the coordinate at position i or named
+// name, given explicitly as 0 when it defaults to it so replays can move it
+STATIC uint8_t dl_coord(mp_obj_t *a, size_t *n_args, size_t *n_kw, size_t i, qstr name) {
+    if (i < *n_args) {
+        return i;
+    }
+    mp_obj_t *kw = a + *n_args;
+    for (size_t k = 0; k < *n_kw; k++) {
+        if (kw[2 * k] == MP_OBJ_NEW_QSTR(name)) {
+            return *n_args + 2 * k + 1;
+        }
     }
+    if (*n_kw == 0) {
+        a[(*n_args)++] = MP_OBJ_NEW_SMALL_INT(0);
+        return i;
+    }
+    kw[2 * *n_kw] = MP_OBJ_NEW_QSTR(name);
+    kw[2 * *n_kw + 1] = MP_OBJ_NEW_SMALL_INT(0);
+    return *n_args + 2 * (*n_kw)++ + 1;
+}
 
-    devid.fbuf = (uint8_t *)m_malloc(jdec.width * jdec.height * 3);
-    devid.wfbuf = jdec.width;
+// Returns the argument at position i or named name, MP_OBJ_NULL if not given
+STATIC mp_obj_t dl_arg(const dl_item_t *it, const mp_obj_t *a, size_t i, qstr name) {
+    if (i < it->n_args) {
+        return a[i];
+    }
+    const mp_obj_t *kw = a + it->n_args;
+    for (size_t k = 0; k < it->n_kw; k++) {
+        if (kw[2 * k] == MP_OBJ_NEW_QSTR(name)) {
+            return kw[2 * k + 1];
+        }
+    }
+    return MP_OBJ_NULL;
+}
 
-    res = jd_decomp(&jdec, out_fast, 0);
-    if (res != JDR_OK) {
-        goto OUT_OF_DECOMP;
-    }
-
-    if (devid.fbuf != NULL) {
-        uint8_t *bitmap_ptr = &devid.fbuf[0];
-        for (size_t yy = 0; yy < jdec.width; yy++) {
-            for (size_t xx = 0; xx < jdec.height; xx++) {
-                uint8_t r = *(bitmap_ptr++);
-                uint8_t g = *(bitmap_ptr++);
-                uint8_t b = *(bitmap_ptr++);
-                setpixel_checked(
-                    self,
-                    x + xx,
-                    y + yy,
-                    converts[self->format](r, g, b),
-                    1
-                );
+// Sets the box of an item from its arguments a, unless it's learned on replay
+STATIC void dl_box(dl_item_t *it, const dl_op_t *op, const mp_obj_t *a) {
+    if (op->box == DL_BOX_ALL || op->box == DL_BOX_IMAGE || op->box == DL_BOX_WRITE) {
+        return;
+    }
+    mp_int_t x = mp_obj_get_int(a[it->xi]);
+    mp_int_t y = mp_obj_get_int(a[it->yi]);
+    const mp_obj_t *b = a + op->x - 1; // x, y and the positional arguments after them
+    mp_int_t x0, y0, x1, y1;
+    switch (op->box) {
+        case DL_BOX_XYWH:
+            dl_span(x, mp_obj_get_int(b[2]), &x0, &x1);
+            dl_span(y, mp_obj_get_int(b[3]), &y0, &y1);
+            break;
+        case DL_BOX_HLINE:
+            dl_span(x, mp_obj_get_int(b[2]), &x0, &x1);
+            dl_span(y, 1, &y0, &y1);
+            break;
+        case DL_BOX_VLINE:
+            dl_span(x, 1, &x0, &x1);
+            dl_span(y, mp_obj_get_int(b[2]), &y0, &y1);
+            break;
+        case DL_BOX_PIXEL:
+            dl_span(x, 1, &x0, &x1);
+            dl_span(y, 1, &y0, &y1);
+            break;
+        case DL_BOX_LINE: {
+            mp_int_t x2 = mp_obj_get_int(b[2]);
+            mp_int_t y2 = mp_obj_get_int(b[3]);
+            x0 = MIN(x, x2);
+            y0 = MIN(y, y2);
+            x1 = MAX(x, x2) + 1;
+            y1 = MAX(y, y2) + 1;
+            break;
+        }
+        case DL_BOX_ELLIPSE: {
+            mp_int_t xr = mp_obj_get_int(b[2]);
+            mp_int_t yr = mp_obj_get_int(b[3]);
+            xr = xr < 0 ? -xr : xr;
+            yr = yr < 0 ? -yr : yr;
+            x0 = x - xr;
+            y0 = y - yr;
+            x1 = x + xr + 1;
+            y1 = y + yr + 1;
+            break;
+        }
+        #if MICROPY_PY_ARRAY
+        case DL_BOX_POLY: {
+            mp_buffer_info_t bufinfo;
+            mp_get_buffer_raise(b[2], &bufinfo, MP_BUFFER_READ);
+            size_t n_poly = bufinfo.len / (mp_binary_get_size('@', bufinfo.typecode, NULL) * 2);
+            x0 = x1 = x;
+            y0 = y1 = y;
+            for (size_t i = 0; i < n_poly; i++) {
+                mp_int_t px = x + poly_int(&bufinfo, 2 * i);
+                mp_int_t py = y + poly_int(&bufinfo, 2 * i + 1);
+                x0 = i ? MIN(x0, px) : px;
+                y0 = i ? MIN(y0, py) : py;
+                x1 = i ? MAX(x1, px + 1) : px + 1;
+                y1 = i ? MAX(y1, py + 1) : py + 1;
             }
+            break;
+        }
+        #endif
+        case DL_BOX_TEXT:
+            x0 = x;
+            y0 = y;
+            x1 = x + 8 * strlen(mp_obj_str_get_str(b[-1]));
+            y1 = y + 8;
+            break;
+        default: { // DL_BOX_SRC
+            mp_obj_t source_in = mp_obj_cast_to_native_base(b[-1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+            if (source_in == MP_OBJ_NULL) {
+                mp_raise_TypeError(NULL);
+            }
+            mp_obj_framebuf_t *source = framebuf_follow(MP_OBJ_TO_PTR(source_in));
+            // rotate of blit() exchanges the sides at 90 and 270
+            mp_obj_t rotate = it->op == DL_BLIT ? dl_arg(it, a, 5, MP_QSTR_rotate) : MP_OBJ_NULL;
+            bool swap = rotate != MP_OBJ_NULL && mp_obj_get_int(rotate) % 180 != 0;
+            x0 = x;
+            y0 = y;
+            x1 = x + (swap ? source->height : source->width);
+            y1 = y + (swap ? source->width : source->height);
+            break;
         }
-    } else {
-        mp_warning(NULL, "No Output frame buffer");
     }
+    dl_set_box(it, x0, y0, x1, y1);
+}
 
-    if (devid.fp != MP_OBJ_NULL) {
-        mp_stream_close(devid.fp);
+// Learns the box of an image from the (w, h) its call returned, and of gfx
+// text from the font of the frame buffer it's drawn on
+STATIC void dl_learn(dl_item_t *it, const mp_obj_framebuf_t *fb, const mp_obj_t *a, mp_obj_t ret) {
+    const dl_op_t *op = &dl_ops[it->op];
+    mp_int_t x = mp_obj_get_int(a[it->xi]);
+    mp_int_t y = mp_obj_get_int(a[it->yi]);
+    if (op->box == DL_BOX_IMAGE && ret != MP_OBJ_NULL && ret != mp_const_none) {
+        mp_obj_t *size;
+        mp_obj_get_array_fixed_n(ret, 2, &size);
+        dl_set_box(it, x, y, x + mp_obj_get_int(size[0]), y + mp_obj_get_int(size[1]));
     }
+    #if SUPPORT_GFX_FONT
+    if (op->box == DL_BOX_WRITE && fb->gfxFont != NULL) {
+        const char *str = mp_obj_str_get_str(a[op->x - 2]);
+        mp_int_t x0 = x, y0 = y, x1 = x, y1 = y;
+        uint32_t cp;
+        while ((cp = next_cp((uint8_t **)&str))) {
+            GFXglyph *glyph = font_get_glyph(fb->gfxFont, cp);
+            if (glyph == NULL) {
+                glyph = font_get_glyph(fb->gfxFont, 0);
+            }
+            if (glyph != NULL) {
+                x0 = MIN(x0, x + glyph->left);
+                y0 = MIN(y0, y - glyph->top);
+                x1 = MAX(x1, x + glyph->left + glyph->width);
+                y1 = MAX(y1, y - glyph->top + glyph->height);
+                x += glyph->xAdvance;
+            }
+        }
+        dl_set_box(it, x0, y0, x1, y1);
+    }
+    #else
+    (void)fb;
+    #endif
+}
 
-    if (devid.fbuf != NULL) {
-        m_free(devid.fbuf);
+// Appends a call of op with n_args positional arguments args and kw_args
+STATIC void dl_record(mp_obj_displaylist_t *dl, unsigned int opi, size_t n_args, const mp_obj_t *args, mp_map_t *kw_args) {
+    const dl_op_t *op = &dl_ops[opi];
+    size_t n_kw = kw_args == NULL ? 0 : kw_args->used;
+    if (n_kw && !op->kw) {
+        mp_raise_TypeError(MP_ERROR_TEXT("function doesn't take keyword arguments"));
+    }
+    if (n_args + 2 * n_kw + 4 > DL_ARGS_MAX || (op->x && n_args < (size_t)(op->x - 1 + dl_box_args[op->box]))) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_t a[DL_ARGS_MAX];
+    memcpy(a, args, n_args * sizeof(mp_obj_t));
+    mp_obj_t *kw = a + n_args;
+    for (size_t i = 0; n_kw && i < kw_args->alloc; i++) {
+        if (mp_map_slot_is_filled(kw_args, i)) {
+            *kw++ = kw_args->table[i].key;
+            *kw++ = kw_args->table[i].value;
+        }
     }
 
-    m_free(work);
-    mp_obj_t value[2];
-    value[0] = mp_obj_new_int(jdec.width);
-    value[1] = mp_obj_new_int(jdec.height);
-    return mp_obj_new_tuple(2, value);
-OUT_OF_MEMORY:
-    mp_raise_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("out of memory(tjpgd work)"));
+    dl_item_t it = { .op = opi, .boxed = false };
+    if (op->x) {
+        it.xi = dl_coord(a, &n_args, &n_kw, op->x - 1, MP_QSTR_x);
+        it.yi = dl_coord(a, &n_args, &n_kw, op->x, MP_QSTR_y);
+    }
+    it.n_args = n_args;
+    it.n_kw = n_kw;
+    dl_box(&it, op, a);
+
+    size_t n = n_args + 2 * n_kw;
+    if (dl->n_items == dl->alloc_items) {
+        size_t alloc = dl->alloc_items ? dl->alloc_items * 2 : 16;
+        dl->items = m_renew(dl_item_t, dl->items, dl->alloc_items, alloc);
+        dl->alloc_items = alloc;
+    }
+    if (dl->n_pool + n > dl->alloc_pool) {
+        size_t alloc = MAX(dl->alloc_pool * 2, dl->n_pool + n + 32);
+        dl->pool = m_renew(mp_obj_t, dl->pool, dl->alloc_pool, alloc);
+        dl->alloc_pool = alloc;
+    }
+    it.arg = dl->n_pool;
+    memcpy(dl->pool + dl->n_pool, a, n * sizeof(mp_obj_t));
+    dl->n_pool += n;
+    dl->items[dl->n_items++] = it;
+}
+
+STATIC void dl_offset(mp_obj_t *a, size_t i, mp_int_t d) {
+    a[i] = mp_obj_new_int(mp_obj_get_int(a[i]) + d);
+}
+
+// Calls the items of dl on fb moved by dx, dy, those within its clip window.
+// The items recorded meanwhile, when fb records into dl, aren't replayed.
+STATIC void dl_replay(mp_obj_displaylist_t *dl, mp_obj_framebuf_t *fb, mp_int_t dx, mp_int_t dy) {
+    mp_obj_t a[1 + DL_ARGS_MAX];
+    a[0] = MP_OBJ_FROM_PTR(fb);
+    size_t n_items = dl->n_items;
+    for (size_t i = 0; i < n_items; i++) {
+        dl_item_t *it = &dl->items[i];
+        if (it->boxed && (it->x1 + dx <= fb->clip_x0 || it->x0 + dx >= fb->clip_x1
+                          || it->y1 + dy <= fb->clip_y0 || it->y0 + dy >= fb->clip_y1)) {
+            continue;
+        }
+        const dl_op_t *op = &dl_ops[it->op];
+        memcpy(a + 1, dl->pool + it->arg, (it->n_args + 2 * it->n_kw) * sizeof(mp_obj_t));
+        if (op->x && (dx || dy)) {
+            dl_offset(a + 1, it->xi, dx);
+            dl_offset(a + 1, it->yi, dy);
+            if (op->box == DL_BOX_LINE) {
+                dl_offset(a + 1, it->xi + 2, dx);
+                dl_offset(a + 1, it->yi + 2, dy);
+            }
+        }
+        mp_obj_t ret = mp_call_function_n_kw(MP_OBJ_FROM_PTR(op->fun), 1 + it->n_args, it->n_kw, a);
+        if (i >= dl->n_items) {
+            break; // cleared by the call, e.g. reading an image from a Python stream
+        }
+        it = &dl->items[i];
+        if (!it->boxed) {
+            dl_learn(it, fb, dl->pool + it->arg, ret);
+        }
+    }
+}
+
+STATIC mp_obj_t displaylist_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args_in) {
+    mp_arg_check_num(n_args, n_kw, 0, 0, false);
+    mp_obj_displaylist_t *o = mp_obj_malloc(mp_obj_displaylist_t, type);
+    o->items = NULL;
+    o->n_items = 0;
+    o->alloc_items = 0;
+    o->pool = NULL;
+    o->n_pool = 0;
+    o->alloc_pool = 0;
+    return MP_OBJ_FROM_PTR(o);
+}
+
+// The drawing methods of DisplayList record a call of the FrameBuffer method
+#define DL_METHOD(name, op) \
+    STATIC mp_obj_t displaylist_##name(size_t n_args, const mp_obj_t *args, mp_map_t *kw_args) { \
+        dl_record(MP_OBJ_TO_PTR(args[0]), op, n_args - 1, args + 1, kw_args); \
+        return mp_const_none; \
+    } \
+    STATIC MP_DEFINE_CONST_FUN_OBJ_KW(displaylist_##name##_obj, 1, displaylist_##name)
+
+DL_METHOD(fill, DL_FILL);
+DL_METHOD(fill_rect, DL_FILL_RECT);
+DL_METHOD(pixel, DL_PIXEL);
+DL_METHOD(hline, DL_HLINE);
+DL_METHOD(vline, DL_VLINE);
+DL_METHOD(rect, DL_RECT);
+DL_METHOD(line, DL_LINE);
+DL_METHOD(ellipse, DL_ELLIPSE);
+#if MICROPY_PY_ARRAY
+DL_METHOD(poly, DL_POLY);
+#endif
+DL_METHOD(text, DL_TEXT);
+DL_METHOD(blit, DL_BLIT);
+DL_METHOD(blit_scaled, DL_BLIT_SCALED);
+#if SUPPORT_DITHER
+DL_METHOD(convert_from, DL_CONVERT_FROM);
+#endif
+#if SUPPORT_GFX_FONT
+DL_METHOD(write, DL_WRITE);
+#endif
+#if SUPPORT_JPG
+DL_METHOD(jpg, DL_JPG);
+#endif
+#if SUPPORT_PNG
+DL_METHOD(png, DL_PNG);
+#endif
+#if SUPPORT_RAW
+DL_METHOD(load_raw, DL_LOAD_RAW);
+DL_METHOD(bmp, DL_BMP);
+DL_METHOD(pgm, DL_PGM);
+#endif
+
+STATIC mp_obj_t displaylist_clear(mp_obj_t self_in) {
+    mp_obj_displaylist_t *self = MP_OBJ_TO_PTR(self_in);
+    m_del(dl_item_t, self->items, self->alloc_items);
+    m_del(mp_obj_t, self->pool, self->alloc_pool);
+    self->items = NULL;
+    self->n_items = 0;
+    self->alloc_items = 0;
+    self->pool = NULL;
+    self->n_pool = 0;
+    self->alloc_pool = 0;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(displaylist_clear_obj, displaylist_clear);
+
+// render(strip, height, sink) draws a frame of height rows, as wide as strip,
+// a band of strip.height rows at a time: the strip is cleared to 0, the items
+// within the band are replayed into it, and it's passed to sink(strip, y), or
+// the rows of the band are written to sink, a file name or a stream
+STATIC mp_obj_t displaylist_render(size_t n_args, const mp_obj_t *args) {
+    mp_obj_displaylist_t *self = MP_OBJ_TO_PTR(args[0]);
+    mp_obj_t strip_in = mp_obj_cast_to_native_base(args[1], MP_OBJ_FROM_PTR(&mp_type_framebuf));
+    if (strip_in == MP_OBJ_NULL) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_framebuf_t *strip = framebuf_follow(MP_OBJ_TO_PTR(strip_in));
+    mp_int_t height = mp_obj_get_int(args[2]);
+    mp_int_t band = strip->height;
+    if (band == 0 || (strip->format == FRAMEBUF_MVLSB && (band & 7))) {
+        mp_raise_ValueError(MP_ERROR_TEXT("invalid band height"));
+    }
+    mp_obj_t sink = args[3];
+    bool call = mp_obj_is_callable(sink);
+    img_out_t out;
+    if (!call) {
+        if (strip->view || strip->rotate) {
+            mp_raise_ValueError(MP_ERROR_TEXT("view or rotated strip needs a callable sink"));
+        }
+        img_out_open(&out, sink);
+    }
+    size_t row_bytes = framebuf_row_bytes(strip->format, strip->stride);
+
+    // the bands are drawn with the whole strip as clip window, the caller's
+    // is restored after the last band or when a call or the sink raises
+    uint16_t clip[4] = { strip->clip_x0, strip->clip_y0, strip->clip_x1, strip->clip_y1 };
+    nlr_buf_t nlr;
+    bool raised = nlr_push(&nlr) != 0;
+    if (!raised) {
+        for (mp_int_t y = 0; y < height; y += band) {
+            mp_int_t rows = MIN(band, height - y);
+            clip_reset(strip);
+            fill_rect(strip, 0, 0, strip->width, band, 0);
+            strip->clip_y1 = rows;
+            dl_replay(self, strip, 0, -y);
+            if (call) {
+                mp_call_function_2(sink, args[1], MP_OBJ_NEW_SMALL_INT(y));
+            } else if (!img_out_write(&out, strip->buf, row_bytes * (strip->format == FRAMEBUF_MVLSB ? (rows + 7) / 8 : rows))) {
+                break;
+            }
+        }
+        nlr_pop();
+    }
+    strip->clip_x0 = clip[0];
+    strip->clip_y0 = clip[1];
+    strip->clip_x1 = clip[2];
+    strip->clip_y1 = clip[3];
+    if (raised) {
+        if (!call) {
+            img_out_abort(&out);
+        }
+        nlr_jump(nlr.ret_val);
+    }
+    if (!call) {
+        img_out_close(&out);
+    }
     return mp_const_none;
-OUT_PREPARE:
-    m_free(work);
-    mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(jd_prepare)"), jd_errors[res]);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(displaylist_render_obj, 4, 4, displaylist_render);
+
+STATIC const mp_rom_map_elem_t displaylist_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_fill), MP_ROM_PTR(&displaylist_fill_obj) },
+    { MP_ROM_QSTR(MP_QSTR_fill_rect), MP_ROM_PTR(&displaylist_fill_rect_obj) },
+    { MP_ROM_QSTR(MP_QSTR_pixel), MP_ROM_PTR(&displaylist_pixel_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hline), MP_ROM_PTR(&displaylist_hline_obj) },
+    { MP_ROM_QSTR(MP_QSTR_vline), MP_ROM_PTR(&displaylist_vline_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rect), MP_ROM_PTR(&displaylist_rect_obj) },
+    { MP_ROM_QSTR(MP_QSTR_line), MP_ROM_PTR(&displaylist_line_obj) },
+    { MP_ROM_QSTR(MP_QSTR_ellipse), MP_ROM_PTR(&displaylist_ellipse_obj) },
+    #if MICROPY_PY_ARRAY
+    { MP_ROM_QSTR(MP_QSTR_poly), MP_ROM_PTR(&displaylist_poly_obj) },
+    #endif
+    { MP_ROM_QSTR(MP_QSTR_text), MP_ROM_PTR(&displaylist_text_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit), MP_ROM_PTR(&displaylist_blit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit_scaled), MP_ROM_PTR(&displaylist_blit_scaled_obj) },
+    #if SUPPORT_DITHER
+    { MP_ROM_QSTR(MP_QSTR_convert_from), MP_ROM_PTR(&displaylist_convert_from_obj) },
+    #endif
+    #if SUPPORT_GFX_FONT
+    { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&displaylist_write_obj) },
+    #endif
+    #if SUPPORT_JPG
+    { MP_ROM_QSTR(MP_QSTR_jpg), MP_ROM_PTR(&displaylist_jpg_obj) },
+    #endif
+    #if SUPPORT_PNG
+    { MP_ROM_QSTR(MP_QSTR_png), MP_ROM_PTR(&displaylist_png_obj) },
+    #endif
+    #if SUPPORT_RAW
+    { MP_ROM_QSTR(MP_QSTR_load_raw), MP_ROM_PTR(&displaylist_load_raw_obj) },
+    { MP_ROM_QSTR(MP_QSTR_bmp), MP_ROM_PTR(&displaylist_bmp_obj) },
+    { MP_ROM_QSTR(MP_QSTR_pgm), MP_ROM_PTR(&displaylist_pgm_obj) },
+    #endif
+    { MP_ROM_QSTR(MP_QSTR_clear), MP_ROM_PTR(&displaylist_clear_obj) },
+    { MP_ROM_QSTR(MP_QSTR_render), MP_ROM_PTR(&displaylist_render_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(displaylist_locals_dict, displaylist_locals_dict_table);
+
+#ifdef MP_OBJ_TYPE_GET_SLOT
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_type_displaylist,
+    MP_QSTR_DisplayList,
+    MP_TYPE_FLAG_NONE,
+    make_new, displaylist_make_new,
+    locals_dict, (mp_obj_dict_t *)&displaylist_locals_dict
+);
+#else
+STATIC const mp_obj_type_t mp_type_displaylist = {
+    { &mp_type_type },
+    .name = MP_QSTR_DisplayList,
+    .make_new = displaylist_make_new,
+    .locals_dict = (mp_obj_dict_t *)&displaylist_locals_dict,
+};
+#endif
+
+// Records a call of a drawing method on fb into the DisplayList of record(),
+// once it has drawn without raising. ret is what the call returns, the
+// (width, height) of images gives their box
+STATIC void record_call(mp_obj_framebuf_t *fb, unsigned int op, size_t n_args, const mp_obj_t *args, mp_map_t *kw_args, mp_obj_t ret) {
+    if (fb->record == MP_OBJ_NULL) {
+        return;
+    }
+    mp_obj_displaylist_t *dl = MP_OBJ_TO_PTR(fb->record);
+    dl_record(dl, op, n_args - 1, args + 1, kw_args);
+    dl_item_t *it = &dl->items[dl->n_items - 1];
+    if (!it->boxed) {
+        dl_learn(it, fb, dl->pool + it->arg, ret);
+    }
+}
+
+STATIC mp_obj_displaylist_t *get_displaylist(mp_obj_t dl_in) {
+    if (!mp_obj_is_type(dl_in, &mp_type_displaylist)) {
+        mp_raise_TypeError(MP_ERROR_TEXT("expected a DisplayList"));
+    }
+    return MP_OBJ_TO_PTR(dl_in);
+}
+
+// record([dl]) records the drawing calls on this frame buffer, still drawn,
+// into dl or a new DisplayList until stop()
+STATIC mp_obj_t framebuf_record(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    if (n_args > 1 && args[1] != mp_const_none) {
+        self->record = MP_OBJ_FROM_PTR(get_displaylist(args[1]));
+    } else {
+        self->record = displaylist_make_new(&mp_type_displaylist, 0, 0, NULL);
+    }
     return mp_const_none;
-OUT_OF_DECOMP:
-    m_free(work);
-    mp_raise_msg_varg(&mp_type_RuntimeError, MP_ERROR_TEXT("%s(jd_decomp)"), jd_errors[res]);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_record_obj, 1, 2, framebuf_record);
+
+// stop() ends the recording and returns the DisplayList, None if not recording
+STATIC mp_obj_t framebuf_stop(mp_obj_t self_in) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(self_in));
+    mp_obj_t dl = self->record;
+    self->record = MP_OBJ_NULL;
+    return dl == MP_OBJ_NULL ? mp_const_none : dl;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(framebuf_stop_obj, framebuf_stop);
+
+// replay(dl[, dx, dy, clip]) draws the calls of dl moved by dx, dy, within
+// the rect clip = (x, y, w, h) of the clip window if given
+STATIC mp_obj_t framebuf_replay(size_t n_args, const mp_obj_t *args) {
+    mp_obj_framebuf_t *self = framebuf_follow(MP_OBJ_TO_PTR(args[0]));
+    mp_obj_displaylist_t *dl = get_displaylist(args[1]);
+    mp_int_t dx = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    mp_int_t dy = n_args > 3 ? mp_obj_get_int(args[3]) : 0;
+    if (n_args <= 4 || args[4] == mp_const_none) {
+        dl_replay(dl, self, dx, dy);
+        return mp_const_none;
+    }
+
+    mp_obj_t *items;
+    mp_obj_get_array_fixed_n(args[4], 4, &items);
+    mp_int_t x = mp_obj_get_int(items[0]);
+    mp_int_t y = mp_obj_get_int(items[1]);
+    mp_int_t x0 = MAX(self->clip_x0, x);
+    mp_int_t y0 = MAX(self->clip_y0, y);
+    mp_int_t x1 = MIN(self->clip_x1, x + mp_obj_get_int(items[2]));
+    mp_int_t y1 = MIN(self->clip_y1, y + mp_obj_get_int(items[3]));
+    if (x0 >= x1 || y0 >= y1) {
+        return mp_const_none;
+    }
+
+    // narrow the clip window for the replay, restored even if a call raises
+    uint16_t clip[4] = { self->clip_x0, self->clip_y0, self->clip_x1, self->clip_y1 };
+    self->clip_x0 = x0;
+    self->clip_y0 = y0;
+    self->clip_x1 = x1;
+    self->clip_y1 = y1;
+    nlr_buf_t nlr;
+    bool raised = nlr_push(&nlr) != 0;
+    if (!raised) {
+        dl_replay(dl, self, dx, dy);
+        nlr_pop();
+    }
+    self->clip_x0 = clip[0];
+    self->clip_y0 = clip[1];
+    self->clip_x1 = clip[2];
+    self->clip_y1 = clip[3];
+    if (raised) {
+        nlr_jump(nlr.ret_val);
+    }
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_jpg_obj, 2, 4, framebuf_jpg);
-#endif // SUPPORT_JPG
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuf_replay_obj, 2, 5, framebuf_replay);
+#endif // SUPPORT_DISPLAY_LIST
 
 #if !MICROPY_ENABLE_DYNRUNTIME
 STATIC const mp_rom_map_elem_t framebuf_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_view), MP_ROM_PTR(&framebuf_view_obj) },
+    { MP_ROM_QSTR(MP_QSTR_set_clip), MP_ROM_PTR(&framebuf_set_clip_obj) },
+    { MP_ROM_QSTR(MP_QSTR_set_rotation), MP_ROM_PTR(&framebuf_set_rotation_obj) },
+    { MP_ROM_QSTR(MP_QSTR_swap), MP_ROM_PTR(&framebuf_swap_obj) },
     { MP_ROM_QSTR(MP_QSTR_fill), MP_ROM_PTR(&framebuf_fill_obj) },
     { MP_ROM_QSTR(MP_QSTR_fill_rect), MP_ROM_PTR(&framebuf_fill_rect_obj) },
     { MP_ROM_QSTR(MP_QSTR_pixel), MP_ROM_PTR(&framebuf_pixel_obj) },
@@ -1546,8 +5343,20 @@ STATIC const mp_rom_map_elem_t framebuf_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_poly), MP_ROM_PTR(&framebuf_poly_obj) },
     #endif
     { MP_ROM_QSTR(MP_QSTR_blit), MP_ROM_PTR(&framebuf_blit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_blit_scaled), MP_ROM_PTR(&framebuf_blit_scaled_obj) },
+    #if SUPPORT_DITHER
+    { MP_ROM_QSTR(MP_QSTR_convert_from), MP_ROM_PTR(&framebuf_convert_from_obj) },
+    #endif
+    #if SUPPORT_IMG_IO || SUPPORT_DITHER
+    { MP_ROM_QSTR(MP_QSTR_tone), MP_ROM_PTR(&framebuf_tone_obj) },
+    #endif
     { MP_ROM_QSTR(MP_QSTR_scroll), MP_ROM_PTR(&framebuf_scroll_obj) },
     { MP_ROM_QSTR(MP_QSTR_text), MP_ROM_PTR(&framebuf_text_obj) },
+    #if SUPPORT_DAMAGE
+    { MP_ROM_QSTR(MP_QSTR_damage), MP_ROM_PTR(&framebuf_damage_obj) },
+    { MP_ROM_QSTR(MP_QSTR_clear_damage), MP_ROM_PTR(&framebuf_clear_damage_obj) },
+    { MP_ROM_QSTR(MP_QSTR_tile_hashes), MP_ROM_PTR(&framebuf_tile_hashes_obj) },
+    #endif
     #if SUPPORT_GFX_FONT
     { MP_ROM_QSTR(MP_QSTR_gfx), MP_ROM_PTR(&framebuf_gfx_obj) },
     { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&framebuf_write_obj) },
@@ -1556,6 +5365,25 @@ STATIC const mp_rom_map_elem_t framebuf_locals_dict_table[] = {
     #if SUPPORT_JPG
     { MP_ROM_QSTR(MP_QSTR_jpg), MP_ROM_PTR(&framebuf_jpg_obj) },
     #endif
+    #if SUPPORT_PNG
+    { MP_ROM_QSTR(MP_QSTR_png), MP_ROM_PTR(&framebuf_png_obj) },
+    #endif
+    #if SUPPORT_RAW
+    { MP_ROM_QSTR(MP_QSTR_load_raw), MP_ROM_PTR(&framebuf_load_raw_obj) },
+    { MP_ROM_QSTR(MP_QSTR_bmp), MP_ROM_PTR(&framebuf_bmp_obj) },
+    { MP_ROM_QSTR(MP_QSTR_pgm), MP_ROM_PTR(&framebuf_pgm_obj) },
+    #endif
+    #if SUPPORT_DISPLAY_LIST
+    { MP_ROM_QSTR(MP_QSTR_record), MP_ROM_PTR(&framebuf_record_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stop), MP_ROM_PTR(&framebuf_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_replay), MP_ROM_PTR(&framebuf_replay_obj) },
+    #endif
+    #if SUPPORT_SAVE
+    { MP_ROM_QSTR(MP_QSTR_save_pgm), MP_ROM_PTR(&framebuf_save_pgm_obj) },
+    #if SUPPORT_PNG
+    { MP_ROM_QSTR(MP_QSTR_save_png), MP_ROM_PTR(&framebuf_save_png_obj) },
+    #endif
+    #endif
 };
 STATIC MP_DEFINE_CONST_DICT(framebuf_locals_dict, framebuf_locals_dict_table);
 
@@ -1591,6 +5419,22 @@ STATIC mp_obj_t legacy_framebuffer1(size_t n_args, const mp_obj_t *args_in) {
     o->width = mp_obj_get_int(args_in[1]);
     o->height = mp_obj_get_int(args_in[2]);
     o->format = FRAMEBUF_MVLSB;
+    clip_reset(o);
+    o->back_obj = MP_OBJ_NULL;
+    o->back = NULL;
+    o->xoff = 0;
+    o->yoff = 0;
+    o->view = false;
+    o->rotate = 0;
+    o->tone = NULL;
+#if SUPPORT_DAMAGE
+    o->damage = m_new0(framebuf_damage_t, 1);
+    o->damage_x = 0;
+    o->damage_y = 0;
+#endif
+#if SUPPORT_DISPLAY_LIST
+    o->record = MP_OBJ_NULL;
+#endif
     if (n_args >= 4) {
         o->stride = mp_obj_get_int(args_in[3]);
     } else {
@@ -1616,6 +5460,35 @@ STATIC const mp_rom_map_elem_t framebuf_module_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_MONO_HMSB), MP_ROM_INT(FRAMEBUF_MHMSB) },
     { MP_ROM_QSTR(MP_QSTR_GS4_HLSB), MP_ROM_INT(FRAMEBUF_GS4_HLSB) },
     { MP_ROM_QSTR(MP_QSTR_RGB888), MP_ROM_INT(FRAMEBUF_RGB888) },
+    { MP_ROM_QSTR(MP_QSTR_FLIP_X), MP_ROM_INT(FLIP_X) },
+    { MP_ROM_QSTR(MP_QSTR_FLIP_Y), MP_ROM_INT(FLIP_Y) },
+    { MP_ROM_QSTR(MP_QSTR_SCALE_NEAREST), MP_ROM_INT(SCALE_NEAREST) },
+    { MP_ROM_QSTR(MP_QSTR_SCALE_BILINEAR), MP_ROM_INT(SCALE_BILINEAR) },
+    { MP_ROM_QSTR(MP_QSTR_SCALE_AREA), MP_ROM_INT(SCALE_AREA) },
+    #if SUPPORT_DITHER
+    { MP_ROM_QSTR(MP_QSTR_DITHER_NONE), MP_ROM_INT(DITHER_NONE) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_FLOYD), MP_ROM_INT(DITHER_FLOYD) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_ATKINSON), MP_ROM_INT(DITHER_ATKINSON) },
+    { MP_ROM_QSTR(MP_QSTR_DITHER_BAYER), MP_ROM_INT(DITHER_BAYER) },
+    #endif
+    #if SUPPORT_JPG
+    { MP_ROM_QSTR(MP_QSTR_JpegDecoder), MP_ROM_PTR(&mp_type_jpegdec) },
+    { MP_ROM_QSTR(MP_QSTR_jpg_info), MP_ROM_PTR(&framebuf_jpg_info_obj) },
+    #endif
+    #if SUPPORT_IMG_CACHE
+    #if MICROPY_MODULE_BUILTIN_INIT
+    { MP_ROM_QSTR(MP_QSTR___init__), MP_ROM_PTR(&framebuf_module_init_obj) },
+    #endif
+    { MP_ROM_QSTR(MP_QSTR_cache), MP_ROM_PTR(&framebuf_cache_obj) },
+    { MP_ROM_QSTR(MP_QSTR_cache_clear), MP_ROM_PTR(&framebuf_cache_clear_obj) },
+    { MP_ROM_QSTR(MP_QSTR_cache_info), MP_ROM_PTR(&framebuf_cache_info_obj) },
+    #endif
+    #if SUPPORT_DAMAGE
+    { MP_ROM_QSTR(MP_QSTR_diff), MP_ROM_PTR(&framebuf_diff_obj) },
+    #endif
+    #if SUPPORT_DISPLAY_LIST
+    { MP_ROM_QSTR(MP_QSTR_DisplayList), MP_ROM_PTR(&mp_type_displaylist) },
+    #endif
 };
 
 STATIC MP_DEFINE_CONST_DICT(framebuf_module_globals, framebuf_module_globals_table);
@@ -0,0 +1,338 @@
+#include <string.h>
+#include "pngdec.h"
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+// Adam7 passes: first column, first row, column step, row step
+static const uint8_t adam7[7][4] = {
+    {0, 0, 8, 8},
+    {4, 0, 8, 8},
+    {0, 4, 4, 8},
+    {2, 0, 4, 4},
+    {0, 2, 2, 4},
+    {1, 0, 2, 2},
+    {0, 1, 1, 2},
+};
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline size_t row_bytes(const PNGDEC *png, uint32_t width) {
+    return ((size_t)width * png->pixel_bits + 7) / 8;
+}
+
+// Checks the IHDR fields, PNG allows only some bit depths per colour type
+static PNGRESULT read_ihdr(PNGDEC *png, const uint8_t *d) {
+    static const uint8_t channels[7] = {1, 0, 3, 1, 2, 0, 4};
+    png->width = get_u32(d);
+    png->height = get_u32(d + 4);
+    png->depth = d[8];
+    png->color_type = d[9];
+    png->interlace = d[12];
+
+    // Capped like the BMP and PGM loaders, so the row sizes can't overflow a size_t
+    if (png->width == 0 || png->height == 0 || png->width > 0xffff || png->height > 0xffff) {
+        return PNG_FMT;
+    }
+    if (png->color_type > PNG_RGBA || channels[png->color_type] == 0) {
+        return PNG_FMT;
+    }
+    switch (png->depth) {
+        case 1:
+        case 2:
+        case 4:
+            if (png->color_type != PNG_GRAY && png->color_type != PNG_PALETTE) {
+                return PNG_FMT;
+            }
+            break;
+        case 8:
+            break;
+        case 16:
+            if (png->color_type == PNG_PALETTE) {
+                return PNG_FMT;
+            }
+            break;
+        default:
+            return PNG_FMT;
+    }
+    if (d[10] != 0 || d[11] != 0 || png->interlace > 1) {
+        return PNG_FMT; // unknown compression or filter method
+    }
+    png->pixel_bits = png->depth * channels[png->color_type];
+    return PNG_OK;
+}
+
+// Reads the chunks up to the first IDAT, the stream is left at its data
+PNGRESULT png_prepare(PNGDEC *png) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint8_t d[16];
+
+    png->width = png->height = 0;
+    png->palette_size = 0;
+    png->has_trns = false;
+    png->chunk_left = 0;
+    memset(png->palette, 0xff, sizeof(png->palette));
+
+    if (png->input(png, d, 8) != 8) {
+        return PNG_INP;
+    }
+    if (memcmp(d, signature, 8) != 0) {
+        return PNG_FMT;
+    }
+
+    for (;;) {
+        // chunk length and type
+        if (png->input(png, d, 8) != 8) {
+            return PNG_INP;
+        }
+        uint32_t len = get_u32(d);
+        uint32_t n = 0; // chunk data bytes read
+        if (len > 0x7fffffff) {
+            return PNG_FMT;
+        }
+
+        if (memcmp(d + 4, "IHDR", 4) == 0) {
+            if (len != 13 || png->width) {
+                return PNG_FMT;
+            }
+            n = len;
+            if (png->input(png, d, n) != n) {
+                return PNG_INP;
+            }
+            PNGRESULT res = read_ihdr(png, d);
+            if (res != PNG_OK) {
+                return res;
+            }
+        } else if (!png->width) {
+            return PNG_FMT; // IHDR must come first
+        } else if (memcmp(d + 4, "PLTE", 4) == 0) {
+            if (len % 3 || len > 256 * 3) {
+                return PNG_FMT;
+            }
+            png->palette_size = len / 3;
+            for (unsigned int i = 0; i < png->palette_size; i++) {
+                if (png->input(png, &png->palette[i * 4], 3) != 3) {
+                    return PNG_INP;
+                }
+            }
+            n = len;
+        } else if (memcmp(d + 4, "tRNS", 4) == 0) {
+            png->has_trns = true;
+            if (png->color_type == PNG_PALETTE) {
+                // alpha of the first palette entries
+                n = MIN(len, 256);
+                for (unsigned int i = 0; i < n; i++) {
+                    if (png->input(png, &png->palette[i * 4 + 3], 1) != 1) {
+                        return PNG_INP;
+                    }
+                }
+            } else if (png->color_type == PNG_GRAY || png->color_type == PNG_RGB) {
+                // key colour, one 16-bit sample per channel
+                n = png->color_type == PNG_GRAY ? 2 : 6;
+                if (len < n || png->input(png, d, n) != n) {
+                    return PNG_INP;
+                }
+                for (unsigned int i = 0; i < n / 2; i++) {
+                    png->trns[i] = (d[i * 2] << 8) | d[i * 2 + 1];
+                }
+            } else {
+                png->has_trns = false; // images with alpha have no tRNS
+            }
+        } else if (memcmp(d + 4, "IDAT", 4) == 0) {
+            if (png->color_type == PNG_PALETTE && png->palette_size == 0) {
+                return PNG_FMT;
+            }
+            png->chunk_left = len;
+            return PNG_OK;
+        } else if (memcmp(d + 4, "IEND", 4) == 0) {
+            return PNG_FMT;
+        }
+
+        // the rest of the chunk and its CRC
+        if (png->input(png, NULL, len - n + 4) != len - n + 4) {
+            return PNG_INP;
+        }
+    }
+}
+
+// Two rows of the widest pass, each with its filter type byte
+size_t png_work_size(const PNGDEC *png) {
+    return 2 * (row_bytes(png, png->width) + 1);
+}
+
+// Makes the next IDAT bytes available to inflate
+static PNGRESULT idat_fill(PNGDEC *png) {
+    uint8_t d[12];
+    size_t n;
+
+    while (png->chunk_left == 0) {
+        // CRC of the current chunk, then length and type of the next one
+        if (png->input(png, d, 12) != 12) {
+            return PNG_INP;
+        }
+        if (memcmp(d + 8, "IDAT", 4) != 0) {
+            return PNG_FMT; // image data ended early
+        }
+        png->chunk_left = get_u32(d + 4);
+    }
+
+    if (png->inref) {
+        const uint8_t *ptr;
+        n = png->inref(png, &ptr, MIN(png->chunk_left, 0x7fffffff));
+        png->zs.next_in = (Bytef *)ptr;
+    } else {
+        n = png->input(png, png->inbuf, MIN(png->chunk_left, PNG_SZBUF));
+        png->zs.next_in = png->inbuf;
+    }
+    if (n == 0) {
+        return PNG_INP;
+    }
+    png->zs.avail_in = n;
+    png->chunk_left -= n;
+    return PNG_OK;
+}
+
+// Inflates len bytes into row
+static PNGRESULT inflate_row(PNGDEC *png, uint8_t *row, size_t len) {
+    png->zs.next_out = row;
+    png->zs.avail_out = len;
+    while (png->zs.avail_out) {
+        if (png->zs.avail_in == 0) {
+            PNGRESULT res = idat_fill(png);
+            if (res != PNG_OK) {
+                return res;
+            }
+        }
+        int ret = inflate(&png->zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            return png->zs.avail_out ? PNG_FMT : PNG_OK;
+        }
+        if (ret != Z_OK) {
+            return ret == Z_MEM_ERROR ? PNG_MEM : PNG_FMT;
+        }
+    }
+    return PNG_OK;
+}
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int p = a + b - c;
+    int pa = p > a ? p - a : a - p;
+    int pb = p > b ? p - b : b - p;
+    int pc = p > c ? p - c : c - p;
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// Reverses the filter of row (len bytes) with the previous row of the pass
+static PNGRESULT unfilter(uint8_t type, uint8_t *row, const uint8_t *prev, size_t len, size_t bpp) {
+    size_t i;
+
+    switch (type) {
+        case 0: // None
+            break;
+        case 1: // Sub
+            for (i = bpp; i < len; i++) {
+                row[i] += row[i - bpp];
+            }
+            break;
+        case 2: // Up
+            for (i = 0; i < len; i++) {
+                row[i] += prev[i];
+            }
+            break;
+        case 3: // Average
+            for (i = 0; i < bpp; i++) {
+                row[i] += prev[i] >> 1;
+            }
+            for (; i < len; i++) {
+                row[i] += (row[i - bpp] + prev[i]) >> 1;
+            }
+            break;
+        case 4: // Paeth
+            for (i = 0; i < bpp; i++) {
+                row[i] += prev[i];
+            }
+            for (; i < len; i++) {
+                row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+            }
+            break;
+        default:
+            return PNG_FMT;
+    }
+    return PNG_OK;
+}
+
+static PNGRESULT decode_rows(PNGDEC *png, png_output_t output, uint8_t *work) {
+    size_t bpp = (png->pixel_bits + 7) / 8;
+    size_t stride = row_bytes(png, png->width) + 1;
+    unsigned int npass = png->interlace ? 7 : 1;
+
+    for (unsigned int p = 0; p < npass; p++) {
+        uint32_t x0 = 0, y0 = 0, dx = 1, dy = 1;
+        if (png->interlace) {
+            x0 = adam7[p][0];
+            y0 = adam7[p][1];
+            dx = adam7[p][2];
+            dy = adam7[p][3];
+        }
+        if (x0 >= png->width || y0 >= png->height) {
+            continue; // empty pass
+        }
+        uint32_t w = (png->width - x0 + dx - 1) / dx;
+        size_t len = row_bytes(png, w);
+
+        // the row above the first one of a pass is all zeros
+        uint8_t *cur = work;
+        uint8_t *prev = work + stride;
+        memset(prev, 0, len + 1);
+
+        for (uint32_t y = y0; y < png->height; y += dy) {
+            PNGRESULT res = inflate_row(png, cur, len + 1);
+            if (res != PNG_OK) {
+                return res;
+            }
+            res = unfilter(cur[0], cur + 1, prev + 1, len, bpp);
+            if (res != PNG_OK) {
+                return res;
+            }
+            if (!output(png, cur + 1, y, x0, dx, w)) {
+                return PNG_INTR;
+            }
+            uint8_t *t = cur;
+            cur = prev;
+            prev = t;
+        }
+    }
+    return PNG_OK;
+}
+
+// Decodes the image set up by png_prepare, work is png_work_size bytes
+PNGRESULT png_decode(PNGDEC *png, png_output_t output, void *work) {
+    memset(&png->zs, 0, sizeof(png->zs));
+    PNGRESULT res = idat_fill(png);
+    if (res != PNG_OK) {
+        return res;
+    }
+
+    // use the window size of the stream, often smaller than 32K for small images
+    uint8_t cmf = png->zs.next_in[0];
+    int wbits = (cmf >> 4) + 8;
+    if ((cmf & 0x0f) != Z_DEFLATED || wbits > MAX_WBITS) {
+        return PNG_FMT;
+    }
+    switch (inflateInit2(&png->zs, wbits)) {
+        case Z_OK:
+            break;
+        case Z_MEM_ERROR:
+            return PNG_MEM;
+        default:
+            return PNG_FMT;
+    }
+
+    res = decode_rows(png, output, work);
+    inflateEnd(&png->zs);
+    return res;
+}
@@ -0,0 +1,70 @@
+#ifndef _PNGDEC_H_
+#define _PNGDEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "zlib/zlib.h"
+
+#define PNG_SZBUF (1024) /** Size of the IDAT input buffer */
+
+/**
+ * @brief Result codes
+ */
+typedef enum {
+    PNG_OK = 0, /** Succeeded */
+    PNG_INTR,   /** Interrupted by the output function */
+    PNG_INP,    /** Device error or wrong termination of input stream */
+    PNG_MEM,    /** Not enough memory for inflate */
+    PNG_FMT,    /** Data format error */
+} PNGRESULT;
+
+/**
+ * @brief IHDR colour types
+ */
+#define PNG_GRAY       (0)
+#define PNG_RGB        (2)
+#define PNG_PALETTE    (3)
+#define PNG_GRAY_ALPHA (4)
+#define PNG_RGBA       (6)
+
+typedef struct _PNGDEC PNGDEC;
+
+/**
+ * @brief Row output function: n pixels of the image row y, the first one at
+ * column x and the following ones every dx columns (dx > 1 in Adam7 passes).
+ * Pixels are packed as in the PNG stream. Returns 0 to stop decoding.
+ */
+typedef int (*png_output_t)(PNGDEC *png, const uint8_t *row, uint32_t y, uint32_t x, uint32_t dx, uint32_t n);
+
+/**
+ * @brief Decoder state, filled by png_prepare
+ */
+struct _PNGDEC {
+    uint32_t width;          /** Image width in pixels */
+    uint32_t height;         /** Image height in pixels */
+    uint8_t depth;           /** Bits per sample: 1, 2, 4, 8 or 16 */
+    uint8_t color_type;      /** One of the PNG_xxx colour types */
+    uint8_t interlace;       /** 0: progressive rows, 1: Adam7 */
+    uint8_t pixel_bits;      /** Bits per pixel */
+    uint16_t palette_size;   /** Number of PLTE entries */
+    bool has_trns;           /** A tRNS chunk was found */
+    uint16_t trns[3];        /** tRNS key colour of gray and RGB images */
+    uint8_t palette[256 * 4]; /** RGBA palette, alpha from tRNS */
+
+    /** Reads len bytes into buf, or skips them if buf is NULL. Returns the number of bytes read. */
+    size_t (*input)(PNGDEC *png, uint8_t *buf, size_t len);
+    /** Optional: points ptr to up to len next bytes of the stream in place. Returns their number. */
+    size_t (*inref)(PNGDEC *png, const uint8_t **ptr, size_t len);
+    void *device;            /** User defined device identifier */
+
+    uint32_t chunk_left;     /** Bytes left in the current IDAT chunk */
+    z_stream zs;             /** The single inflate context of the IDAT stream */
+    uint8_t inbuf[PNG_SZBUF]; /** IDAT input buffer, unused with inref */
+};
+
+PNGRESULT png_prepare(PNGDEC *png);
+size_t png_work_size(const PNGDEC *png);
+PNGRESULT png_decode(PNGDEC *png, png_output_t output, void *work);
+
+#endif // _PNGDEC_H_
@@ -0,0 +1,139 @@
+#include <string.h>
+#include "pngenc.h"
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Writes a chunk: length, type, data and the CRC of type and data
+static PNGRESULT write_chunk(PNGENC *png, const char *type, const uint8_t *data, uint32_t len) {
+    uint8_t d[8];
+    put_u32(d, len);
+    memcpy(d + 4, type, 4);
+    uint32_t crc = crc32(0, d + 4, 4);
+    if (len) {
+        crc = crc32(crc, data, len);
+    }
+    if (!png->output(png, d, 8) || (len && !png->output(png, data, len))) {
+        return PNG_INP;
+    }
+    put_u32(d, crc);
+    return png->output(png, d, 4) ? PNG_OK : PNG_INP;
+}
+
+// Writes the signature and the IHDR chunk and sets up deflate
+PNGRESULT png_enc_start(PNGENC *png) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint8_t d[13];
+
+    if (png->width == 0 || png->height == 0 || png->width > 0x7fffffff || png->height > 0x7fffffff) {
+        return PNG_FMT;
+    }
+    if (png->color_type == PNG_GRAY && (png->depth == 1 || png->depth == 2 || png->depth == 4 || png->depth == 8)) {
+        png->pixel_bits = png->depth;
+    } else if (png->color_type == PNG_RGB && png->depth == 8) {
+        png->pixel_bits = 24;
+    } else {
+        return PNG_FMT;
+    }
+
+    if (!png->output(png, signature, 8)) {
+        return PNG_INP;
+    }
+    put_u32(d, png->width);
+    put_u32(d + 4, png->height);
+    d[8] = png->depth;
+    d[9] = png->color_type;
+    d[10] = 0; // deflate
+    d[11] = 0; // adaptive filtering
+    d[12] = 0; // no interlace
+    PNGRESULT res = write_chunk(png, "IHDR", d, 13);
+    if (res != PNG_OK) {
+        return res;
+    }
+
+    // a small window keeps the deflate state to a few K, whatever the image size
+    png->rows = 0;
+    memset(&png->zs, 0, sizeof(png->zs));
+    switch (deflateInit2(&png->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, PNG_ENC_WBITS, PNG_ENC_MEMLEVEL, Z_DEFAULT_STRATEGY)) {
+        case Z_OK:
+            break;
+        case Z_MEM_ERROR:
+            return PNG_MEM;
+        default:
+            return PNG_FMT;
+    }
+    png->zs.next_out = png->outbuf;
+    png->zs.avail_out = PNG_ENC_SZBUF;
+    return PNG_OK;
+}
+
+// Bytes of a row without its filter type byte
+size_t png_enc_row_bytes(const PNGENC *png) {
+    return ((size_t)png->width * png->pixel_bits + 7) / 8;
+}
+
+// Deflates the pending input, writing an IDAT chunk each time the output buffer is full
+static PNGRESULT deflate_out(PNGENC *png, int flush) {
+    for (;;) {
+        int ret = deflate(&png->zs, flush);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return PNG_FMT;
+        }
+        size_t n = PNG_ENC_SZBUF - png->zs.avail_out;
+        bool done = flush == Z_FINISH ? ret == Z_STREAM_END : png->zs.avail_in == 0 && png->zs.avail_out != 0;
+        if (n == PNG_ENC_SZBUF || (done && flush == Z_FINISH && n)) {
+            PNGRESULT res = write_chunk(png, "IDAT", png->outbuf, n);
+            if (res != PNG_OK) {
+                return res;
+            }
+            png->zs.next_out = png->outbuf;
+            png->zs.avail_out = PNG_ENC_SZBUF;
+        }
+        if (done) {
+            return PNG_OK;
+        }
+    }
+}
+
+// Encodes the next row: row[0] is free for the filter type, the pixels
+// packed as in the PNG stream follow. The pixels are filtered in place.
+PNGRESULT png_enc_row(PNGENC *png, uint8_t *row) {
+    size_t len = png_enc_row_bytes(png);
+
+    if (png->rows >= png->height) {
+        return PNG_FMT;
+    }
+    if (png->depth == 8) {
+        // Sub, for gradients and photos, rows of packed gray levels stay unfiltered
+        size_t bpp = png->pixel_bits / 8;
+        for (size_t i = len; i > bpp; i--) {
+            row[i] -= row[i - bpp];
+        }
+        row[0] = 1;
+    } else {
+        row[0] = 0;
+    }
+    png->zs.next_in = row;
+    png->zs.avail_in = len + 1;
+    png->rows++;
+    return deflate_out(png, Z_NO_FLUSH);
+}
+
+// Flushes the IDAT stream and writes the IEND chunk, once all the rows are encoded
+PNGRESULT png_enc_finish(PNGENC *png) {
+    PNGRESULT res = png->rows == png->height ? deflate_out(png, Z_FINISH) : PNG_FMT;
+    deflateEnd(&png->zs);
+    if (res != PNG_OK) {
+        return res;
+    }
+    return write_chunk(png, "IEND", NULL, 0);
+}
+
+// Frees the deflate state of an encoding that won't be finished
+void png_enc_abort(PNGENC *png) {
+    deflateEnd(&png->zs);
+}
@@ -0,0 +1,37 @@
+#ifndef _PNGENC_H_
+#define _PNGENC_H_
+
+#include "pngdec.h"
+
+#define PNG_ENC_SZBUF (1024) /** Size of the IDAT output buffer, the size of the IDAT chunks */
+#define PNG_ENC_WBITS (11)   /** Deflate window of 2K */
+#define PNG_ENC_MEMLEVEL (3) /** Deflate hash and literal buffers of 1K to 2K */
+
+typedef struct _PNGENC PNGENC;
+
+/**
+ * @brief Encoder state, width, height, depth, color_type and output set by the caller
+ */
+struct _PNGENC {
+    uint32_t width;          /** Image width in pixels */
+    uint32_t height;         /** Image height in pixels */
+    uint8_t depth;           /** Bits per sample: 1, 2, 4 or 8 */
+    uint8_t color_type;      /** PNG_GRAY or PNG_RGB */
+    uint8_t pixel_bits;      /** Bits per pixel */
+
+    /** Writes len bytes of buf. Returns 0 on error, the encoder then returns PNG_INP. */
+    int (*output)(PNGENC *png, const uint8_t *buf, size_t len);
+    void *device;            /** User defined device identifier */
+
+    uint32_t rows;           /** Rows encoded so far */
+    z_stream zs;             /** The single deflate context of the IDAT stream */
+    uint8_t outbuf[PNG_ENC_SZBUF]; /** IDAT output buffer */
+};
+
+PNGRESULT png_enc_start(PNGENC *png);
+size_t png_enc_row_bytes(const PNGENC *png);
+PNGRESULT png_enc_row(PNGENC *png, uint8_t *row);
+PNGRESULT png_enc_finish(PNGENC *png);
+void png_enc_abort(PNGENC *png);
+
+#endif // _PNGENC_H_
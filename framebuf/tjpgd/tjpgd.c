@@ -21,6 +21,7 @@
 /----------------------------------------------------------------------------*/
 
 #include "tjpgd.h"
+#include <string.h>
 
 
 /*-----------------------------------------------*/
@@ -147,6 +148,32 @@ static void* alloc_pool (	/* Pointer to allocated memory block (NULL:no memory a
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Allocate the working buffers for IDCT, RGB output and the MCU         */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT alloc_work (	/* 0:OK, !0:Failed */
+	JDEC* jd				/* Pointer to the decompressor object */
+)
+{
+	unsigned int n, len;
+
+
+	n = jd->msy * jd->msx;						/* Number of Y blocks in the MCU */
+	if (!n) return JDR_FMT1;					/* Err: SOF0 has not been loaded */
+	len = n * 64 * 2 + 64;						/* Allocate buffer for IDCT and RGB output */
+	if (len < 256) len = 256;					/* but at least 256 byte is required for IDCT */
+	jd->workbuf = alloc_pool(jd, len);			/* and it may occupy a part of following MCU working buffer for RGB output */
+	if (!jd->workbuf) return JDR_MEM1;			/* Err: not enough memory */
+	jd->mcubuf = (uint8_t*)alloc_pool(jd, (unsigned int)((n + 2) * 64));	/* Allocate MCU working buffer */
+	if (!jd->mcubuf) return JDR_MEM1;			/* Err: not enough memory */
+
+	return JDR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Create de-quantization and prescaling tables with a DQT segment       */
 /*-----------------------------------------------------------------------*/
@@ -238,6 +265,25 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Re-fill the bit stream input buffer                                   */
+/*-----------------------------------------------------------------------*/
+
+static unsigned int refill (	/* Number of bytes available (0:read error or wrong stream termination) */
+	JDEC* jd,			/* Pointer to the decompressor object */
+	uint8_t** dp		/* Pointer to the read pointer to be set */
+)
+{
+#if JD_DIRECTIN
+	if (jd->inref) return jd->inref(jd, dp);	/* Refer to the stream data in place */
+#endif
+	*dp = jd->inbuf;	/* Top of input buffer */
+	return jd->infunc(jd, *dp, JD_SZBUF);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Extract N bits from input stream                                      */
 /*-----------------------------------------------------------------------*/
@@ -252,13 +298,12 @@ static int bitext (	/* >=0: extracted data, <0: error code */
 
 
 	msk = jd->dmsk; dc = jd->dctr; dp = jd->dptr;	/* Bit mask, number of data available, read ptr */
-	s = *dp; v = f = 0;
+	s = jd->dbyte; v = f = 0;
 
 	do {
 		if (!msk) {				/* Next byte? */
 			if (!dc) {			/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = refill(jd, &dp);
 				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
 			} else {
 				dp++;			/* Next data ptr */
@@ -267,7 +312,7 @@ static int bitext (	/* >=0: extracted data, <0: error code */
 			if (f) {			/* In flag sequence? */
 				f = 0;			/* Exit flag sequence */
 				if (*dp != 0) return 0 - (int)JDR_FMT1;	/* Err: unexpected flag is detected (may be collapted data) */
-				*dp = s = 0xFF;			/* The flag is a data 0xFF */
+				s = 0xFF;				/* The flag is a data 0xFF */
 			} else {
 				s = *dp;				/* Get next data byte */
 				if (s == 0xFF) {		/* Is start of flag sequence? */
@@ -282,7 +327,7 @@ static int bitext (	/* >=0: extracted data, <0: error code */
 		nbit--;
 	} while (nbit);
 
-	jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp;
+	jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp; jd->dbyte = s;
 
 	return (int)v;
 }
@@ -306,13 +351,12 @@ static int huffext (		/* >=0: decoded data, <0: error code */
 
 
 	msk = jd->dmsk; dc = jd->dctr; dp = jd->dptr;	/* Bit mask, number of data available, read ptr */
-	s = *dp; v = f = 0;
+	s = jd->dbyte; v = f = 0;
 	bl = 16;	/* Max code length */
 	do {
 		if (!msk) {		/* Next byte? */
 			if (!dc) {	/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = refill(jd, &dp);
 				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
 			} else {
 				dp++;	/* Next data ptr */
@@ -321,7 +365,7 @@ static int huffext (		/* >=0: decoded data, <0: error code */
 			if (f) {		/* In flag sequence? */
 				f = 0;		/* Exit flag sequence */
 				if (*dp != 0) return 0 - (int)JDR_FMT1;	/* Err: unexpected flag is detected (may be collapted data) */
-				*dp = s = 0xFF;			/* The flag is a data 0xFF */
+				s = 0xFF;				/* The flag is a data 0xFF */
 			} else {
 				s = *dp;				/* Get next data byte */
 				if (s == 0xFF) {		/* Is start of flag sequence? */
@@ -336,7 +380,7 @@ static int huffext (		/* >=0: decoded data, <0: error code */
 
 		for (nd = *hbits++; nd; nd--) {	/* Search the code word in this bit length */
 			if (v == *hcode++) {		/* Matched? */
-				jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp;
+				jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp; jd->dbyte = s;
 				return *hdata;			/* Return the decoded data */
 			}
 			hdata++;
@@ -467,7 +511,8 @@ static void block_idct (
 /*-----------------------------------------------------------------------*/
 
 static JRESULT mcu_load (
-	JDEC* jd		/* Pointer to the decompressor object */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	int out			/* 0:The MCU is not output, only parse it from the input stream */
 )
 {
 	int32_t *tmp = (int32_t*)jd->workbuf;	/* Block working buffer for de-quantize and IDCT */
@@ -503,10 +548,12 @@ static JRESULT mcu_load (
 			jd->dcv[cmp] = (int16_t)d;			/* Save current DC value for next block */
 		}
 		dqf = jd->qttbl[jd->qtid[cmp]];			/* De-quantizer table ID for this component */
-		tmp[0] = d * dqf[0] >> 8;				/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+		if (out) {
+			tmp[0] = d * dqf[0] >> 8;			/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+			for (i = 1; i < 64; tmp[i++] = 0) ;	/* Clear rest of elements */
+		}
 
 		/* Extract following 63 AC elements from input stream */
-		for (i = 1; i < 64; tmp[i++] = 0) ;		/* Clear rest of elements */
 		hb = jd->huffbits[id][1];				/* Huffman table for the AC elements */
 		hc = jd->huffcode[id][1];
 		hd = jd->huffdata[id][1];
@@ -523,17 +570,21 @@ static JRESULT mcu_load (
 			if (b &= 0x0F) {					/* Bit length */
 				d = bitext(jd, b);				/* Extract data bits */
 				if (d < 0) return 0 - d;		/* Err: input device */
-				b = 1 << (b - 1);				/* MSB position */
-				if (!(d & b)) d -= (b << 1) - 1;/* Restore negative value if needed */
-				z = ZIG(i);						/* Zigzag-order to raster-order converted index */
-				tmp[z] = d * dqf[z] >> 8;		/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+				if (out) {
+					b = 1 << (b - 1);				/* MSB position */
+					if (!(d & b)) d -= (b << 1) - 1;/* Restore negative value if needed */
+					z = ZIG(i);						/* Zigzag-order to raster-order converted index */
+					tmp[z] = d * dqf[z] >> 8;		/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+				}
 			}
 		} while (++i < 64);		/* Next AC element */
 
-		if (JD_USE_SCALE && jd->scale == 3) {
-			*bp = (uint8_t)((*tmp / 256) + 128);	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
-		} else {
-			block_idct(tmp, bp);		/* Apply IDCT and store the block to the MCU buffer */
+		if (out) {
+			if (JD_USE_SCALE && jd->scale == 3) {
+				*bp = (uint8_t)((*tmp / 256) + 128);	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
+			} else {
+				block_idct(tmp, bp);		/* Apply IDCT and store the block to the MCU buffer */
+			}
 		}
 
 		bp += 64;				/* Next block */
@@ -714,8 +765,7 @@ static JRESULT restart (
 	d = 0;
 	for (i = 0; i < 2; i++) {
 		if (!dc) {	/* No input data is available, re-fill input buffer */
-			dp = jd->inbuf;
-			dc = jd->infunc(jd, dp, JD_SZBUF);
+			dc = refill(jd, &dp);
 			if (!dc) return JDR_INP;
 		} else {
 			dp++;
@@ -739,6 +789,244 @@ static JRESULT restart (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Skip a restart interval without decoding it                           */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT skip_interval (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t rstn	/* Expected restert sequense number at the end of the interval */
+)
+{
+	unsigned int dc;
+	uint8_t *dp, *p, d, f;
+
+
+	/* Search the RSTn marker at the end of the interval */
+	dp = jd->dptr; dc = jd->dctr;
+	f = 0;
+	for (;;) {
+		if (!dc) {	/* No input data is available, re-fill input buffer */
+			dc = refill(jd, &dp);
+			if (!dc) return JDR_INP;
+		} else {
+			dp++;
+		}
+		if (!f) {	/* Jump to the next flag in the available data */
+			p = memchr(dp, 0xFF, dc);
+			if (!p) {
+				dp += dc - 1; dc = 0;
+				continue;
+			}
+			dc -= (unsigned int)(p - dp);
+			dp = p;
+		}
+		dc--;
+		d = *dp;
+		if (f && d >= 0xD0 && d <= 0xD7) break;	/* RSTn marker */
+		if (f && d != 0x00 && d != 0xFF) return JDR_FMT1;	/* Err: unexpected marker (may be collapted data) */
+		f = (d == 0xFF);	/* Start of flag sequence or fill byte */
+	}
+	jd->dptr = dp; jd->dctr = dc; jd->dmsk = 0;
+
+	/* Check the marker */
+	if ((d & 7) != (rstn & 7)) return JDR_FMT1;	/* Err: unexpected RSTn marker */
+
+	/* Reset DC offset */
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Check if a run of MCUs has any MCU in the output region               */
+/*-----------------------------------------------------------------------*/
+
+static int mcu_run_hit (
+	unsigned int m,		/* Index of the first MCU in the run */
+	unsigned int n,		/* Number of MCUs in the run */
+	unsigned int nx,	/* Number of MCUs in a row */
+	const JRECT* rgn	/* Output region in unit of MCU */
+)
+{
+	unsigned int e, r0, r1;
+
+
+	e = m + n - 1;				/* Last MCU of the run */
+	r0 = m / nx; r1 = e / nx;	/* First and last row of the run */
+	if (r1 < rgn->top || r0 > rgn->bottom) return 0;
+	if (r0 < rgn->top) { r0 = rgn->top; m = r0 * nx; }
+	if (r1 > rgn->bottom) { r1 = rgn->bottom; e = r1 * nx + nx - 1; }
+	if (r0 == r1) return m % nx <= rgn->right && e % nx >= rgn->left;
+	if (r1 - r0 >= 2) return 1;	/* A whole row of the region is in the run */
+	return m % nx <= rgn->right || e % nx >= rgn->left;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Reuse tables built from identical DHT/DQT segments                    */
+/*-----------------------------------------------------------------------*/
+
+#if JD_TBLCACHE
+
+static void** tbl_slot (	/* Pointer to the table pointer */
+	JDEC* jd,			/* Pointer to the decompressor object */
+	unsigned int i		/* Table slot (0..15) */
+)
+{
+	if (i < 4) return (void**)&jd->huffbits[i >> 1][i & 1];
+	if (i < 8) return (void**)&jd->huffcode[(i - 4) >> 1][i & 1];
+	if (i < 12) return (void**)&jd->huffdata[(i - 8) >> 1][i & 1];
+	return (void**)&jd->qttbl[i - 12];
+}
+
+
+static uint32_t tbl_hash (	/* FNV-1a hash of the segment */
+	uint16_t marker,		/* Segment marker */
+	const uint8_t* seg,		/* Segment content */
+	unsigned int len		/* Length of the segment content */
+)
+{
+	uint32_t h = 2166136261UL;
+
+
+	h = (h ^ (marker & 0xFF)) * 16777619UL;
+	h = (h ^ (len >> 8)) * 16777619UL;
+	h = (h ^ (len & 0xFF)) * 16777619UL;
+	while (len--) h = (h ^ *seg++) * 16777619UL;
+
+	return h;
+}
+
+
+static int tbl_owns (	/* 1:Table slot i of the segment is the table at offset ofs */
+	const JTBLSEG* ts,	/* Cache entry of the segment */
+	unsigned int i,		/* Table slot (0..15) */
+	unsigned int ofs	/* Pool offset of the table */
+)
+{
+	return (ts->mask & (1 << i)) && ts->tbl[i] == ofs;
+}
+
+
+static int tbl_same (	/* 1:The tables of the cache entry were built from the segment, 0:Not or unsure */
+	JDEC* jd,			/* Pointer to the decompressor object */
+	const JTBLSEG* ts,	/* Cache entry */
+	uint16_t marker,	/* Segment marker */
+	const uint8_t* seg,	/* Segment content */
+	unsigned int len	/* Length of the segment content */
+)
+{
+	unsigned int i, np, cls, num, ofs = ts->start;
+	const uint8_t *pool = (const uint8_t*)jd->tblpool;
+	const int32_t *pq;
+
+
+	/* Walk the segment as create_qt_tbl/create_huffman_tbl allocate its tables and compare them byte by byte */
+	while (len) {
+		if ((marker & 0xFF) == 0xDB) {	/* DQT */
+			if (len < 65 || (*seg & 0xF0) || !tbl_owns(ts, 12 + (*seg & 3), ofs)) return 0;
+			pq = (const int32_t*)(pool + ofs);
+			for (i = 0; i < 64; i++) {
+				if (pq[ZIG(i)] != (int32_t)((uint32_t)seg[1 + i] * IPSF(ZIG(i)))) return 0;
+			}
+			seg += 65; len -= 65;
+			ofs += 64 * sizeof (int32_t);
+		} else {						/* DHT */
+			if (len < 17 || (*seg & 0xEE)) return 0;
+			cls = *seg >> 4; num = *seg & 0x0F;
+			if (!tbl_owns(ts, num * 2 + cls, ofs) || memcmp(pool + ofs, seg + 1, 16)) return 0;
+			for (np = i = 0; i < 16; i++) np += seg[1 + i];
+			seg += 17; len -= 17;
+			ofs += 16 + ((np * sizeof (uint16_t) + 3) & ~3);	/* The code words follow from the bit distribution */
+			if (len < np || !tbl_owns(ts, 8 + num * 2 + cls, ofs) || memcmp(pool + ofs, seg, np)) return 0;
+			seg += np; len -= np;
+			ofs += (np + 3) & ~3;
+		}
+	}
+
+	return ofs == ts->end;
+}
+
+
+static int tbl_reuse (	/* 1:Tables of the segment have been restored, 0:Tables need to be created */
+	JDEC* jd,			/* Pointer to the decompressor object */
+	uint16_t marker,	/* Segment marker */
+	const uint8_t* seg,	/* Segment content */
+	unsigned int len,	/* Length of the segment content */
+	uint32_t hash		/* Hash of the segment */
+)
+{
+	JTBLSEG *ts;
+	unsigned int i;
+	uint8_t *p;
+
+
+	if (jd->tblidx >= jd->ntbl) return 0;
+	ts = &jd->tblseg[jd->tblidx];
+	p = (uint8_t*)jd->pool;
+	if (ts->hash != hash || ts->len != len || p != (uint8_t*)jd->tblpool + ts->start) return 0;
+	if (!tbl_same(jd, ts, marker, seg, len)) return 0;	/* Equal hashes of different segments */
+
+	for (i = 0; i < 16; i++) {	/* Restore pointers to the tables of this segment */
+		if (ts->mask & (1 << i)) *tbl_slot(jd, i) = (uint8_t*)jd->tblpool + ts->tbl[i];
+	}
+	jd->sz_pool -= ts->end - ts->start;	/* Skip the tables in the pool */
+	jd->pool = (uint8_t*)jd->tblpool + ts->end;
+	jd->tblidx++; jd->tblhit++;
+
+	return 1;
+}
+
+
+static void tbl_record (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	uint32_t hash,		/* Hash of the segment */
+	unsigned int len,	/* Length of the segment content */
+	uint8_t* start		/* Pool pointer before the tables were created */
+)
+{
+	JTBLSEG *ts;
+	unsigned int i, j;
+	uint8_t *p, *end;
+
+
+	if (jd->tblidx < JD_TBLCACHE) {
+		end = (uint8_t*)jd->pool;
+		ts = &jd->tblseg[jd->tblidx];
+		ts->hash = hash;
+		ts->len = (uint16_t)len;
+		ts->start = (uint16_t)(start - (uint8_t*)jd->tblpool);
+		ts->end = (uint16_t)(end - (uint8_t*)jd->tblpool);
+		ts->mask = 0;
+		for (i = 0; i < 16; i++) {	/* Tables allocated in this area are owned by the segment */
+			p = *tbl_slot(jd, i);
+			if (p >= start && p < end) {
+				ts->mask |= 1 << i;
+				ts->tbl[i] = (uint16_t)(p - (uint8_t*)jd->tblpool);
+			}
+		}
+		for (j = jd->tblidx + 1; j < jd->ntbl; j++) {	/* Discard following entries overwritten by the tables */
+			if (jd->tblseg[j].start < ts->end) {
+				jd->ntbl = j;
+				break;
+			}
+		}
+		if (jd->ntbl <= jd->tblidx) jd->ntbl = jd->tblidx + 1;
+	}
+	jd->tblidx++;
+}
+
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Analyze the JPEG image and Initialize decompressor object             */
 /*-----------------------------------------------------------------------*/
@@ -757,17 +1045,33 @@ JRESULT jd_prepare (
 	uint8_t *seg, b;
 	uint16_t marker;
 	uint32_t ofs;
-	unsigned int n, i, j, len;
+	unsigned int i, j, len;
 	JRESULT rc;
+#if JD_TBLCACHE
+	uint32_t hash;
+	uint8_t *tblp;
+#endif
 
 
 	if (!pool) return JDR_PAR;
+	if (sz_pool > 0xFFFF && JD_TBLCACHE) sz_pool = 0xFFFF;	/* Cache entries hold 16-bit pool offsets */
 
 	jd->pool = pool;		/* Work memroy */
 	jd->sz_pool = sz_pool;	/* Size of given work memory */
 	jd->infunc = infunc;	/* Stream input function */
 	jd->device = dev;		/* I/O device identifier */
+#if JD_DIRECTIN
+	jd->inref = 0;			/* Bit stream is read via the input buffer (default) */
+#endif
 	jd->nrst = 0;			/* No restart interval (default) */
+	jd->width = jd->height = 0;	/* No SOF0 segment has been loaded */
+	jd->msx = jd->msy = 0;
+#if JD_TBLCACHE
+	if (jd->tblpool != pool || jd->tblsz != sz_pool) jd->ntbl = 0;	/* Cached tables are only valid in their own pool */
+	jd->tblpool = pool;
+	jd->tblsz = sz_pool;
+	jd->tblidx = jd->tblhit = 0;
+#endif
 
 	for (i = 0; i < 2; i++) {	/* Nulls pointers */
 		for (j = 0; j < 2; j++) {
@@ -835,8 +1139,17 @@ JRESULT jd_prepare (
 			if (len > JD_SZBUF) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
 
+#if JD_TBLCACHE
+			hash = tbl_hash(marker, seg, len);
+			if (tbl_reuse(jd, marker, seg, len, hash)) break;	/* Same tables as the previous image */
+			tblp = (uint8_t*)jd->pool;
+#endif
 			/* Create huffman tables */
 			rc = create_huffman_tbl(jd, seg, len);
+#if JD_TBLCACHE
+			if (rc) jd->ntbl = jd->tblidx < jd->ntbl ? jd->tblidx : jd->ntbl;	/* Following entries may be broken */
+			else tbl_record(jd, hash, len, tblp);
+#endif
 			if (rc) return rc;
 			break;
 
@@ -845,8 +1158,17 @@ JRESULT jd_prepare (
 			if (len > JD_SZBUF) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
 
+#if JD_TBLCACHE
+			hash = tbl_hash(marker, seg, len);
+			if (tbl_reuse(jd, marker, seg, len, hash)) break;	/* Same tables as the previous image */
+			tblp = (uint8_t*)jd->pool;
+#endif
 			/* Create de-quantizer tables */
 			rc = create_qt_tbl(jd, seg, len);
+#if JD_TBLCACHE
+			if (rc) jd->ntbl = jd->tblidx < jd->ntbl ? jd->tblidx : jd->ntbl;	/* Following entries may be broken */
+			else tbl_record(jd, hash, len, tblp);
+#endif
 			if (rc) return rc;
 			break;
 
@@ -872,15 +1194,13 @@ JRESULT jd_prepare (
 				}
 			}
 
+#if JD_TBLCACHE
+			if (jd->ntbl > jd->tblidx) jd->ntbl = jd->tblidx;	/* Following entries will be overwritten by the working buffers */
+#endif
+
 			/* Allocate working buffer for MCU and RGB */
-			n = jd->msy * jd->msx;						/* Number of Y blocks in the MCU */
-			if (!n) return JDR_FMT1;					/* Err: SOF0 has not been loaded */
-			len = n * 64 * 2 + 64;						/* Allocate buffer for IDCT and RGB output */
-			if (len < 256) len = 256;					/* but at least 256 byte is required for IDCT */
-			jd->workbuf = alloc_pool(jd, len);			/* and it may occupy a part of following MCU working buffer for RGB output */
-			if (!jd->workbuf) return JDR_MEM1;			/* Err: not enough memory */
-			jd->mcubuf = (uint8_t*)alloc_pool(jd, (unsigned int)((n + 2) * 64));	/* Allocate MCU working buffer */
-			if (!jd->mcubuf) return JDR_MEM1;			/* Err: not enough memory */
+			rc = alloc_work(jd);
+			if (rc) return rc;
 
 			/* Pre-load the JPEG data to extract it from the bit stream */
 			jd->dptr = seg; jd->dctr = 0; jd->dmsk = 0;	/* Prepare to read bit stream */
@@ -918,6 +1238,80 @@ JRESULT jd_prepare (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get the image information without preparing the decompression         */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_probe (
+	JDEC* jd,				/* Decompressor object to store the image information */
+	unsigned int (*infunc)(JDEC*, uint8_t*, unsigned int),	/* JPEG strem input function */
+	void* dev				/* I/O device identifier for the session */
+)
+{
+	uint8_t seg[8];
+	uint16_t marker;
+	unsigned int len, n;
+
+
+	jd->infunc = infunc;	/* Stream input function */
+	jd->device = dev;		/* I/O device identifier */
+	jd->nrst = 0;			/* No restart interval (default) */
+	jd->width = jd->height = 0;
+	jd->msx = jd->msy = 0;
+	jd->ncomp = 0;
+
+	if (jd->infunc(jd, seg, 2) != 2) return JDR_INP;/* Check SOI marker */
+	if (LDB_WORD(seg) != 0xFFD8) return JDR_FMT1;	/* Err: SOI is not detected */
+
+	for (;;) {
+		/* Get a JPEG marker */
+		if (jd->infunc(jd, seg, 4) != 4) return JDR_INP;
+		marker = LDB_WORD(seg);		/* Marker */
+		len = LDB_WORD(seg + 2);	/* Length field */
+		if (len <= 2 || (marker >> 8) != 0xFF) return JDR_FMT1;
+		len -= 2;		/* Content size excluding length field */
+
+		n = 0;			/* Number of content bytes loaded */
+		switch (marker & 0xFF) {
+		case 0xC4:	/* DHT */
+		case 0xC8:	/* JPG */
+		case 0xCC:	/* DAC */
+			break;
+
+		case 0xDD:	/* DRI */
+			if (len < 2) return JDR_FMT1;
+			n = 2;
+			if (jd->infunc(jd, seg, n) != n) return JDR_INP;
+			jd->nrst = LDB_WORD(seg);	/* Restart interval (MCUs) */
+			break;
+
+		case 0xDA:	/* SOS, the image information is in the headers above */
+			if (!jd->width || !jd->height) return JDR_FMT1;	/* Err: Invalid image size */
+			return JDR_OK;
+
+		case 0xD9:	/* EOI */
+			return JDR_FMT1;
+
+		default:
+			if ((marker & 0xF0) != 0xC0) break;	/* Not a SOFn segment */
+			if (len < 8) return JDR_FMT1;
+			n = 8;
+			if (jd->infunc(jd, seg, n) != n) return JDR_INP;
+			jd->height = LDB_WORD(seg+1);		/* Image height in unit of pixel */
+			jd->width = LDB_WORD(seg+3);		/* Image width in unit of pixel */
+			jd->ncomp = seg[5];					/* Number of color components */
+			jd->msx = seg[7] >> 4; jd->msy = seg[7] & 15;	/* Size of MCU [blocks], from the first component */
+			if (jd->ncomp == 1) jd->msx = jd->msy = 1;	/* A gray scale image is not interleaved */
+		}
+
+		/* Skip the rest of the segment data */
+		if (len > n && jd->infunc(jd, 0, len - n) != len - n) return JDR_INP;
+	}
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Start to decompress the JPEG picture                                  */
 /*-----------------------------------------------------------------------*/
@@ -928,36 +1322,182 @@ JRESULT jd_decomp (
 	uint8_t scale							/* Output de-scaling factor (0 to 3) */
 )
 {
-	unsigned int x, y, mx, my;
-	uint16_t rst, rsc;
+	return jd_decomp_rect(jd, outfunc, scale, 0);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress a region of the JPEG picture                               */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_rect (
+	JDEC* jd,								/* Initialized decompression object */
+	int (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint8_t scale,							/* Output de-scaling factor (0 to 3) */
+	const JRECT* rect						/* Region of the input image to output (0:entire image) */
+)
+{
+	return jd_decomp_part(jd, outfunc, scale, rect, 0, 0);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress a region of the JPEG picture in some restart intervals     */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_part (
+	JDEC* jd,								/* Initialized decompression object */
+	int (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint8_t scale,							/* Output de-scaling factor (0 to 3) */
+	const JRECT* rect,						/* Region of the input image to output (0:entire image) */
+	unsigned int first,						/* First restart interval to output */
+	unsigned int count						/* Number of restart intervals to output (0:up to the end) */
+)
+{
 	JRESULT rc;
 
 
+	rc = jd_decomp_start(jd, scale, rect, first, count);
+	if (rc != JDR_OK) return rc;
+
+	return jd_decomp_step(jd, outfunc, 0);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Set up a resumable decompression                                      */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_start (
+	JDEC* jd,								/* Initialized decompression object */
+	uint8_t scale,							/* Output de-scaling factor (0 to 3) */
+	const JRECT* rect,						/* Region of the input image to output (0:entire image) */
+	unsigned int first,						/* First restart interval to output */
+	unsigned int count						/* Number of restart intervals to output (0:up to the end) */
+)
+{
+	unsigned int n, nx, mx, my;
+
+
 	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	if (!jd->nrst && first) return JDR_PAR;		/* No restart interval in the stream */
 	jd->scale = scale;
 
 	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+	nx = (jd->width + mx - 1) / mx;				/* Number of MCUs in a row */
+
+	jd->mcu = jd->nmcu = 0;						/* Nothing to decompress (default) */
+	jd->rgn.left = jd->rgn.top = 0;				/* Output region in unit of MCU */
+	jd->rgn.right = nx - 1; jd->rgn.bottom = (jd->height - 1) / my;
+	if (rect) {
+		if (rect->left > rect->right || rect->top > rect->bottom) return JDR_OK;	/* Empty region */
+		if (rect->left >= jd->width || rect->top >= jd->height) return JDR_OK;	/* Out of the image */
+		jd->rgn.left = rect->left / mx; jd->rgn.top = rect->top / my;
+		if (rect->right / mx < jd->rgn.right) jd->rgn.right = rect->right / mx;
+		if (rect->bottom / my < jd->rgn.bottom) jd->rgn.bottom = rect->bottom / my;
+	}
+	n = (jd->rgn.bottom + 1) * nx;				/* MCUs below the region are never decoded */
+	if (jd->nrst && count && (first + count) * jd->nrst < n) n = (first + count) * jd->nrst;
+	jd->nmcu = n;
+	jd->rfirst = first;
 
 	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
-	rst = rsc = 0;
+	jd->rsc = 0;
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Continue a resumable decompression                                    */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_step (
+	JDEC* jd,								/* Decompression object set up by jd_decomp_start */
+	int (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	unsigned int nmcu						/* Maximum number of MCUs to decompress (0:all the rest) */
+)
+{
+	unsigned int m, n, e, nx, mx, my, cx, cy;
+	JRESULT rc;
+
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+	nx = (jd->width + mx - 1) / mx;				/* Number of MCUs in a row */
+	m = jd->mcu; n = jd->nmcu;
+	e = (nmcu && nmcu < n - m) ? m + nmcu : n;	/* End of this step */
 
 	rc = JDR_OK;
-	for (y = 0; y < jd->height; y += my) {		/* Vertical loop of MCUs */
-		for (x = 0; x < jd->width; x += mx) {	/* Horizontal loop of MCUs */
-			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
-				rc = restart(jd, rsc++);
+	for ( ; m < e; m++) {
+		if (jd->nrst && m % jd->nrst == 0) {	/* Top of a restart interval */
+			if (m) {
+				rc = restart(jd, jd->rsc++);	/* Process restart interval */
 				if (rc != JDR_OK) return rc;
-				rst = 1;
 			}
-			rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream and apply IDCT) */
-			if (rc != JDR_OK) return rc;
-			rc = mcu_output(jd, outfunc, x, y);	/* Output the MCU (color space conversion, scaling and output) */
+			while (m / jd->nrst < jd->rfirst || !mcu_run_hit(m, jd->nrst, nx, &jd->rgn)) {	/* Skip intervals not to be output */
+				if (m + jd->nrst >= n) {		/* Nothing to output in the rest */
+					jd->mcu = n;
+					return JDR_OK;
+				}
+				rc = skip_interval(jd, jd->rsc++);
+				if (rc != JDR_OK) return rc;
+				m += jd->nrst;
+			}
+		}
+		cx = m % nx; cy = m / nx;
+		if (cx < jd->rgn.left || cx > jd->rgn.right || cy < jd->rgn.top) {
+			rc = mcu_load(jd, 0);				/* Parse an MCU out of the region */
 			if (rc != JDR_OK) return rc;
+			continue;
 		}
+		rc = mcu_load(jd, 1);					/* Load an MCU (decompress huffman coded stream and apply IDCT) */
+		if (rc != JDR_OK) return rc;
+		rc = mcu_output(jd, outfunc, cx * mx, cy * my);	/* Output the MCU (color space conversion, scaling and output) */
+		if (rc != JDR_OK) return rc;
 	}
+	jd->mcu = m;
 
 	return rc;
 }
 
 
 
+
+#if JD_DIRECTIN
+/*-----------------------------------------------------------------------*/
+/* Create a decompressor object sharing the tables of another one        */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_fork (
+	const JDEC* jd,			/* Prepared decompressor object, decompression not started */
+	JDEC* sub,				/* Decompressor object to be initialized */
+	void* pool,				/* Working buffer for the IDCT and MCU buffers of sub */
+	unsigned int sz_pool,	/* Size of working buffer */
+	void* dev				/* I/O device identifier for sub, at the same stream position as jd */
+)
+{
+	if (!pool || !jd->inref) return JDR_PAR;	/* The shared input buffer must not be re-filled */
+
+	*sub = *jd;
+	sub->pool = pool;		/* Work memroy */
+	sub->sz_pool = sz_pool;	/* Size of given work memory */
+	sub->device = dev;		/* I/O device identifier */
+#if JD_TBLCACHE
+	sub->tblpool = 0;		/* The tables belong to jd */
+	sub->ntbl = 0;
+#endif
+
+	return alloc_work(sub);
+}
+#endif
+
+
+
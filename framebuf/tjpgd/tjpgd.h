@@ -10,6 +10,8 @@
 #define JD_FORMAT		0	/* Output pixel format 0:RGB888 (3 BYTE/pix), 1:RGB565 (1 WORD/pix) */
 #define	JD_USE_SCALE	1	/* Use descaling feature for output */
 #define JD_TBLCLIP		1	/* Use table for saturation (might be a bit faster but increases 1K bytes of code size) */
+#define JD_DIRECTIN		1	/* Allow the bit stream to be read in place from the caller's memory (jd->inref) */
+#define JD_TBLCACHE		8	/* Number of DHT/DQT segments whose tables can be reused by the next jd_prepare (0:disable) */
 
 /*---------------------------------------------------------------------------*/
 
@@ -49,6 +51,19 @@ typedef struct {
 
 
 
+#if JD_TBLCACHE
+/* Table segment cache entry */
+typedef struct {
+	uint32_t hash;				/* Hash of the segment (marker, length and content) */
+	uint16_t len;				/* Length of the segment content */
+	uint16_t start, end;		/* Pool area of the tables built from the segment */
+	uint16_t mask;				/* Table slots loaded by the segment */
+	uint16_t tbl[16];			/* Pool offsets of the loaded tables */
+} JTBLSEG;
+#endif
+
+
+
 /* Decompressor object structure */
 typedef struct JDEC JDEC;
 struct JDEC {
@@ -56,11 +71,17 @@ struct JDEC {
 	uint8_t* dptr;				/* Current data read ptr */
 	uint8_t* inbuf;				/* Bit stream input buffer */
 	uint8_t dmsk;				/* Current bit in the current read byte */
+	uint8_t dbyte;				/* Current read byte */
 	uint8_t scale;				/* Output scaling ratio */
 	uint8_t msx, msy;			/* MCU size in unit of block (width, height) */
+	uint8_t ncomp;				/* Number of color components (set by jd_probe) */
 	uint8_t qtid[3];			/* Quantization table ID of each component */
 	int16_t dcv[3];				/* Previous DC element of each component */
 	uint16_t nrst;				/* Restart inverval */
+	uint16_t rsc;				/* Restart interval counter */
+	unsigned int rfirst;		/* First restart interval to output */
+	unsigned int mcu, nmcu;		/* Next MCU to decompress and end of the MCUs to decompress */
+	JRECT rgn;					/* Output region in unit of MCU */
 	uint16_t width, height;		/* Size of the input image (pixel) */
 	uint8_t* huffbits[2][2];	/* Huffman bit distribution tables [id][dcac] */
 	uint16_t* huffcode[2][2];	/* Huffman code word tables [id][dcac] */
@@ -72,13 +93,40 @@ struct JDEC {
 	unsigned int sz_pool;		/* Size of momory pool (bytes available) */
 	unsigned int (*infunc)(JDEC*, uint8_t*, unsigned int);	/* Pointer to jpeg stream input function */
 	void* device;				/* Pointer to I/O device identifiler for the session */
+#if JD_DIRECTIN
+	unsigned int (*inref)(JDEC*, uint8_t**);	/* Optional in-place stream input function (cleared by jd_prepare) */
+#endif
+#if JD_TBLCACHE
+	void* tblpool;				/* Memory pool the cached tables live in */
+	unsigned int tblsz;			/* Size of the memory pool the cached tables live in */
+	uint8_t ntbl;				/* Number of valid cache entries */
+	uint8_t tblidx;				/* Number of table segments processed by the current jd_prepare */
+	uint8_t tblhit;				/* Number of table segments reused by the current jd_prepare */
+	JTBLSEG tblseg[JD_TBLCACHE];	/* Table segments that built the tables in the memory pool */
+#endif
 };
 
 
 
 /* TJpgDec API functions */
+/* When JD_TBLCACHE is enabled, the decompressor object must be zero-filled before its first jd_prepare.
+   Following jd_prepare calls with the same memory pool reuse the tables of identical DHT/DQT segments. */
 JRESULT jd_prepare (JDEC* jd, unsigned int (*infunc)(JDEC*,uint8_t*,unsigned int), void* pool, unsigned int sz_pool, void* dev);
+/* jd_probe only reads the headers up to the first SOS to get width, height, ncomp, msx, msy and nrst.
+   It needs no memory pool and accepts any SOFn image, including ones that cannot be decompressed. */
+JRESULT jd_probe (JDEC* jd, unsigned int (*infunc)(JDEC*,uint8_t*,unsigned int), void* dev);
 JRESULT jd_decomp (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), uint8_t scale);
+JRESULT jd_decomp_rect (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), uint8_t scale, const JRECT* rect);
+JRESULT jd_decomp_part (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), uint8_t scale, const JRECT* rect, unsigned int first, unsigned int count);
+/* jd_decomp_part split in two: jd_decomp_step decompresses a bounded number of MCUs per call and can be
+   called again until jd->mcu reaches jd->nmcu. The decompression cannot be continued after an error. */
+JRESULT jd_decomp_start (JDEC* jd, uint8_t scale, const JRECT* rect, unsigned int first, unsigned int count);
+JRESULT jd_decomp_step (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), unsigned int nmcu);
+#if JD_DIRECTIN
+/* jd_fork creates a decompressor that shares the tables and the stream position of a prepared one read with jd->inref.
+   Each of them can decompress different restart intervals with jd_decomp_part, concurrently. */
+JRESULT jd_fork (const JDEC* jd, JDEC* sub, void* pool, unsigned int sz_pool, void* dev);
+#endif
 
 
 #ifdef __cplusplus
@@ -2,12 +2,73 @@ import unittest
 import epd
 import framebuf_plus
 import time
+import struct
 from array import array
 try:
     from FiraSansBold16pt import FiraSansBold16pt as GFXFont
     is_test_font = True
 except:
     is_test_font = False
+try:
+    import os
+    os.stat("test.jpg")
+    is_test_jpg = True
+except:
+    is_test_jpg = False
+try:
+    os.stat("test.png")
+    is_test_png = True
+except:
+    is_test_png = False
+
+# 32x16 colour jpegs, with a restart interval of one MCU and without
+JPG_RST = bytes.fromhex(
+    "ffd8ffe000104a46494600010100000100010000ffdb004300100b0c0e0c0a100e0d0e12"
+    "11101318281a181616183123251d283a333d3c3933383740485c4e404457453738506d51"
+    "575f626768673e4d71797064785c656763ffdb0043011112121815182f1a1a2f63423842"
+    "636363636363636363636363636363636363636363636363636363636363636363636363"
+    "6363636363636363636363636363ffc00011080010002003012200021101031101ffc400"
+    "17000003010000000000000000000000000003040506ffc4001e10000105010003010000"
+    "0000000000000002000103041121123171a1ffc400160101010100000000000000000000"
+    "000000040305ffc4001c1100020202030000000000000000000000010300110441020512"
+    "ffdd00040001ffda000c03010002110311003f00cad4af99c57ea57cce2054af99c55601"
+    "8e166790847ebabbf0af534ca02c599fffd06a29e084784c659acc3dfd44af1119f99bb9"
+    "13fb774bd4af99c55ea57cce22b3ae1c6ea03298c791e8501a9fffd9"
+)
+JPG_NO_RST = bytes.fromhex(
+    "ffd8ffe000104a46494600010100000100010000ffdb004300100b0c0e0c0a100e0d0e12"
+    "11101318281a181616183123251d283a333d3c3933383740485c4e404457453738506d51"
+    "575f626768673e4d71797064785c656763ffdb0043011112121815182f1a1a2f63423842"
+    "636363636363636363636363636363636363636363636363636363636363636363636363"
+    "6363636363636363636363636363ffc00011080010002003012200021101031101ffc400"
+    "17000101010100000000000000000000000003050406ffc4001e10000105010003010000"
+    "0000000000000002000103041121123171a1ffc400160101010100000000000000000000"
+    "000000050306ffc4001c1100020202030000000000000000000000010300110441020512"
+    "ffda000c03010002110311003f00e56a57cce2bf52be671054af99c556018e166790847e"
+    "babbf0af513280b1663c53c108f098cb35987bfa92bc4467e66ee44feddd67a95f338abd"
+    "4af99c4733ae1c6ea677298c791e8501a9ffd9"
+)
+
+# 16x16 jpeg of a flat mid gray, (128, 128, 128)
+JPG_GRAY = bytes.fromhex(
+    "ffd8ffe000104a46494600010100000100010000ffdb0043000806060706050807070709"
+    "09080a0c140d0c0b0b0c1912130f141d1a1f1e1d1a1c1c20242e2720222c231c1c283729"
+    "2c30313434341f27393d38323c2e333432ffdb0043010909090c0b0c180d0d1832211c21"
+    "323232323232323232323232323232323232323232323232323232323232323232323232"
+    "3232323232323232323232323232ffc00011080010001003012200021101031101ffc400"
+    "14000100000000000000000000000000000000ffc4001410010000000000000000000000"
+    "0000000000ffc40014010100000000000000000000000000000000ffc400141101000000"
+    "00000000000000000000000000ffda000c03010002110311003f00000fffd9"
+)
+
+# A BMP of rows padded to 4 bytes, bottom-up for a positive h, with a
+# BITMAPINFOHEADER of hsize bytes, the colour masks after it
+def bmp_file(w, h, bits, rows, palette=b"", masks=b"", compression=0, hsize=40):
+    off = 14 + hsize + len(masks) + len(palette)
+    data = b"".join(rows)
+    return (b"BM" + struct.pack("<IHHI", off + len(data), 0, 0, off)
+            + struct.pack("<IiiHHIIiiII", hsize, w, h, 1, bits, compression, len(data), 0, 0, len(palette) // 4, 0)
+            + bytes(hsize - 40) + masks + palette + data)
 
 class TestFrameBuffer(unittest.TestCase):
     def __init__(self):
@@ -72,5 +133,353 @@ class TestFrameBuffer(unittest.TestCase):
         except:
             pass
 
+    @unittest.skipUnless(is_test_jpg, "No test.jpg file, skip")
+    def test_jpg_decoder(self):
+        decoder = framebuf_plus.JpegDecoder()
+        w, h = decoder.decode(self.fb, "test.jpg", 0, 0)
+        self.assertEqual(decoder.decode(self.fb, "test.jpg", w, 0), (w, h))
+
+    @unittest.skipUnless(is_test_jpg, "No test.jpg file, skip")
+    def test_jpg_step(self):
+        decoder = framebuf_plus.JpegDecoder()
+        w, h = decoder.start(self.fb, "test.jpg", 0, 0)
+        left = decoder.step(16)
+        while left:
+            n = decoder.step(16)
+            self.assertTrue(n < left)
+            left = n
+        self.assertEqual(decoder.step(16), 0)
+
+    @unittest.skipUnless(is_test_jpg, "No test.jpg file, skip")
+    def test_jpg_info(self):
+        info = framebuf_plus.jpg_info("test.jpg")
+        self.assertEqual(len(info), 6)
+        with open("test.jpg", "rb") as f:
+            self.assertEqual(framebuf_plus.jpg_info(f.read()), info)
+        self.assertEqual(self.fb.jpg("test.jpg", 0, 0), info[:2])
+
+    @unittest.skipUnless(is_test_jpg, "No test.jpg file, skip")
+    def test_jpg_crop(self):
+        w, h = self.fb.jpg("test.jpg", 0, 0)
+        self.assertEqual(self.fb.jpg("test.jpg", 0, h, crop=(w // 4, h // 4, w // 2, h // 2)), (w, h))
+
+    def test_jpg_threads(self):
+        for jpg in (JPG_RST, JPG_NO_RST):
+            self.assertEqual(framebuf_plus.jpg_info(jpg)[5] != 0, jpg is JPG_RST)
+            for fmt, bpp in ((framebuf_plus.RGB565, 2), (framebuf_plus.GS8, 1)):
+                bufs = []
+                for threads in (1, 2, 4):
+                    buf = bytearray(32 * 16 * bpp)
+                    fb = framebuf_plus.FrameBuffer(buf, 32, 16, fmt)
+                    self.assertEqual(framebuf_plus.JpegDecoder(threads=threads).decode(fb, jpg, 0, 0), (32, 16))
+                    bufs.append(buf)
+                self.assertEqual(bufs[0], bufs[1])
+                self.assertEqual(bufs[0], bufs[2])
+                self.assertNotEqual(bufs[0], bytearray(len(bufs[0])))
+
+    @unittest.skipUnless(is_test_jpg, "No test.jpg file, skip")
+    def test_cache(self):
+        framebuf_plus.cache(512 * 1024)
+        hits, misses = framebuf_plus.cache_info()[:2]
+        size = self.fb.jpg("test.jpg", 0, 0)
+        self.assertEqual(self.fb.jpg("test.jpg", 10, 10), size)
+        self.assertEqual(framebuf_plus.cache_info()[:2], (hits + 1, misses + 1))
+        framebuf_plus.cache(0)
+        self.assertEqual(framebuf_plus.cache_info()[3:], (0, 0, 0))
+
+    def test_view(self):
+        fb = framebuf_plus.FrameBuffer(bytearray(32 * 8 // 2), 32, 8, framebuf_plus.GS4_HLSB)
+        v = fb.view(3, 2, 10, 4)
+        v.fill(7)
+        v.pixel(0, 0, 15)
+        self.assertEqual((fb.pixel(2, 2), fb.pixel(3, 2), fb.pixel(4, 2), fb.pixel(12, 5), fb.pixel(13, 5)), (0, 15, 7, 7, 0))
+        self.assertEqual(v.view(1, 1, 2, 2).pixel(0, 0), 7)
+        with self.assertRaises(ValueError):
+            fb.view(30, 0, 4, 4)
+
+    @unittest.skipUnless(is_test_font, "No gfx font file, skip")
+    def test_view_font(self):
+        buf = bytearray(64 * 32)
+        fb = framebuf_plus.FrameBuffer(buf, 64, 32, framebuf_plus.GS8)
+        fb.fill(255)
+        fb.gfx(GFXFont)
+        v = fb.view(0, 0, 64, 32)
+        fb.gfx(GFXFont)
+        v.write("A", 0, 24)
+        self.assertEqual(buf, bytearray(b"\xff" * len(buf)))
+        v.gfx(GFXFont)
+        fb.gfx(None)
+        v.write("A", 0, 24)
+        self.assertNotEqual(buf, bytearray(b"\xff" * len(buf)))
+
+    def test_clip(self):
+        fb = framebuf_plus.FrameBuffer(bytearray(32 * 32), 32, 32, framebuf_plus.GS8)
+        fb.set_clip(8, 8, 16, 16)
+        fb.fill(255)
+        fb.line(0, 0, 31, 31, 128)
+        self.assertEqual((fb.pixel(7, 7), fb.pixel(8, 8), fb.pixel(20, 10), fb.pixel(24, 24)), (0, 128, 255, 0))
+        fb.set_clip()
+        fb.fill_rect(0, 0, 4, 4, 9)
+        self.assertEqual(fb.pixel(0, 0), 9)
+
+    def test_display_list(self):
+        dl = framebuf_plus.DisplayList()
+        dl.fill(15)
+        dl.fill_rect(10, 10, 20, 40, 0)
+        dl.text("band", 30, 60, 3)
+        strip = framebuf_plus.FrameBuffer(bytearray(64 * 16 // 2), 64, 16, framebuf_plus.GS4_HLSB)
+        bands = []
+        def sink(fb, y):
+            bands.append((y, fb.pixel(10, 0), fb.pixel(0, 15)))
+        dl.render(strip, 72, sink)
+        self.assertEqual(bands, [(0, 15, 15), (16, 0, 15), (32, 0, 15), (48, 0, 15), (64, 15, 0)])
+        dl.render(strip, 72, lambda fb, y: self.fb.blit(fb, 0, 200 + y))
+        # the strip keeps its clip window, even when the sink raises
+        strip.set_clip(4, 4, 8, 8)
+        def fail(fb, y):
+            raise OSError(28)
+        with self.assertRaises(OSError):
+            dl.render(strip, 72, fail)
+        strip.fill(7)
+        self.assertEqual((strip.pixel(4, 4), strip.pixel(3, 4), strip.pixel(4, 12)), (7, 15, 15))
+
+    def test_record(self):
+        fb = framebuf_plus.FrameBuffer(bytearray(32 * 32), 32, 32, framebuf_plus.GS8)
+        fb.record()
+        fb.fill_rect(2, 2, 4, 4, 200)
+        fb.line(0, 31, 31, 0, 100)
+        dl = fb.stop()
+        self.assertEqual(fb.stop(), None)
+        self.assertEqual(fb.pixel(3, 3), 200)
+        other = framebuf_plus.FrameBuffer(bytearray(32 * 32), 32, 32, framebuf_plus.GS8)
+        other.replay(dl, 10, 0)
+        self.assertEqual((other.pixel(3, 3), other.pixel(13, 3)), (0, 200))
+        other.fill(0)
+        other.replay(dl, 0, 0, (0, 0, 16, 16))
+        # the line crosses the clip rect corner at (15, 16) and (16, 15)
+        self.assertEqual((other.pixel(3, 3), other.pixel(15, 16), other.pixel(16, 15)), (200, 0, 0))
+        # calls that raise aren't recorded
+        fb.record()
+        with self.assertRaises(OSError):
+            fb.png("missing.png", 0, 0)
+        with self.assertRaises(TypeError):
+            fb.fill_rect(0, 0, 4, 4, "x")
+        fb.pixel(1, 1, 50)
+        dl = fb.stop()
+        other.fill(0)
+        other.replay(dl)
+        self.assertEqual((other.pixel(1, 1), other.pixel(0, 0)), (50, 0))
+
+    def test_rotation(self):
+        buf = bytearray(16 * 8)
+        fb = framebuf_plus.FrameBuffer(buf, 16, 8, framebuf_plus.GS8)
+        fb.set_rotation(90)
+        fb.pixel(0, 0, 1)
+        fb.hline(0, 2, 8, 2)
+        self.assertEqual((buf[15], buf[13], buf[7 * 16 + 13], fb.pixel(7, 15), fb.pixel(15, 0)), (1, 2, 2, 0, None))
+        fb.set_rotation(0, True)
+        fb.pixel(0, 0, 3)
+        self.assertEqual(buf[15], 3)
+        with self.assertRaises(ValueError):
+            fb.set_rotation(45)
+
+    def test_blit_rotate(self):
+        src = framebuf_plus.FrameBuffer(bytearray(16 * 8 // 8), 16, 8, framebuf_plus.MONO_HLSB)
+        src.hline(0, 0, 16, 1)
+        src.pixel(0, 7, 1)
+        fb = framebuf_plus.FrameBuffer(bytearray(8 * 16 // 8), 8, 16, framebuf_plus.MONO_HLSB)
+        fb.blit(src, 0, 0, rotate=90)
+        self.assertEqual((fb.pixel(7, 0), fb.pixel(7, 15), fb.pixel(0, 0), fb.pixel(6, 1)), (1, 1, 1, 0))
+        fb.fill(0)
+        fb.blit(src, 0, 0, -1, None, 270, framebuf_plus.FLIP_X)
+        self.assertEqual((fb.pixel(0, 0), fb.pixel(0, 15), fb.pixel(7, 0), fb.pixel(7, 15)), (1, 1, 1, 0))
+
+    def test_blit_scaled(self):
+        src = framebuf_plus.FrameBuffer(bytearray([0, 200, 100, 40]), 2, 2, framebuf_plus.GS8)
+        fb = framebuf_plus.FrameBuffer(bytearray(4 * 4), 4, 4, framebuf_plus.GS8)
+        fb.blit_scaled(src, 0, 0, 4, 4)
+        self.assertEqual((fb.pixel(1, 1), fb.pixel(3, 0), fb.pixel(0, 3)), (0, 200, 100))
+        fb.blit_scaled(src, 0, 0, 4, 4, framebuf_plus.SCALE_BILINEAR)
+        self.assertEqual((fb.pixel(0, 0), fb.pixel(1, 0), fb.pixel(2, 0), fb.pixel(3, 0)), (0, 50, 150, 200))
+        fb.blit_scaled(src, 3, 3, 1, 1, framebuf_plus.SCALE_AREA)
+        self.assertEqual(fb.pixel(3, 3), 85)
+        mono = framebuf_plus.FrameBuffer(bytearray(8), 8, 8, framebuf_plus.MONO_HLSB)
+        with self.assertRaises(ValueError):
+            fb.blit_scaled(mono, 0, 0, 4, 4, framebuf_plus.SCALE_BILINEAR)
+
+    def test_swap(self):
+        a, b = bytearray(16 * 8), bytearray(16 * 8)
+        fb = framebuf_plus.FrameBuffer(a, 16, 8, framebuf_plus.GS8, back=b)
+        fb.fill(1)
+        fb.clear_damage()
+        fb.fill_rect(2, 2, 3, 3, 9)
+        self.assertIs(fb.swap(True), a)
+        self.assertEqual((b[0], b[2 * 16 + 2], b[5 * 16 + 5]), (0, 9, 0))
+        fb.pixel(0, 0, 5)
+        self.assertIs(fb.swap(), b)
+        self.assertEqual((fb.pixel(0, 0), b[0]), (1, 5))
+        with self.assertRaises(ValueError):
+            framebuf_plus.FrameBuffer(a, 16, 8, framebuf_plus.GS8, back=bytearray(8))
+        with self.assertRaises(ValueError):
+            fb.view(0, 0, 4, 4).swap()
+        v = fb.view(4, 2, 8, 4).view(1, 1, 2, 2)
+        fb.swap()
+        v.pixel(0, 0, 7)
+        self.assertEqual((fb.pixel(5, 3), b[3 * 16 + 5], a[3 * 16 + 5]), (7, 7, 1))
+        with self.assertRaises(ValueError):
+            framebuf_plus.FrameBuffer(bytearray(8), 16, 8, framebuf_plus.GS8, back=b)
+
+    def test_damage(self):
+        self.fb.clear_damage()
+        self.assertEqual(self.fb.damage(), [])
+        self.fb.fill_rect(10, 10, 20, 5, 0)
+        self.fb.hline(30, 12, 10, 0)
+        self.assertEqual(self.fb.damage(), [(10, 10, 30, 5)])
+        self.fb.text("damage", 900, 500, 0)
+        self.assertEqual(len(self.fb.damage()), 2)
+        self.fb.clear_damage()
+        self.fb.pixel(-1, 0, 0)
+        self.assertEqual(self.fb.damage(), [])
+
+    def test_diff(self):
+        a = framebuf_plus.FrameBuffer(bytearray(64 * 32 // 2), 64, 32, framebuf_plus.GS4_HLSB)
+        b = framebuf_plus.FrameBuffer(bytearray(64 * 32 // 2), 64, 32, framebuf_plus.GS4_HLSB)
+        self.assertEqual(framebuf_plus.diff(a, b), [])
+        b.pixel(20, 5, 15)
+        b.pixel(40, 20, 15)
+        self.assertEqual(framebuf_plus.diff(a, b), [(16, 0, 16, 16), (32, 16, 16, 16)])
+        self.assertEqual(framebuf_plus.diff(a, b, tile=32), [(0, 0, 64, 32)])
+        # a view starting mid-byte, on either side
+        big = framebuf_plus.FrameBuffer(bytearray(66 * 32 // 2), 66, 32, framebuf_plus.GS4_HLSB)
+        v = big.view(1, 0, 64, 32)
+        with self.assertRaises(ValueError):
+            framebuf_plus.diff(v, a)
+        with self.assertRaises(ValueError):
+            framebuf_plus.diff(a, v)
+
+    def test_tile_hashes(self):
+        fb = framebuf_plus.FrameBuffer(bytearray(64 * 32 // 2), 64, 32, framebuf_plus.GS4_HLSB)
+        before = array('I', bytes(4 * 8))
+        self.assertEqual(fb.tile_hashes(16, 16, before), (4, 2))
+        fb.pixel(40, 20, 15)
+        after = array('I', bytes(4 * 8))
+        fb.tile_hashes(16, 16, after)
+        self.assertEqual([i for i in range(8) if before[i] != after[i]], [6])
+        with self.assertRaises(ValueError):
+            fb.tile_hashes(12, 16, after)
+
+    def test_load_raw(self):
+        # 4x2 GS4_HLSB image, two pixels per byte with the left one in the low nibble
+        self.fb.load_raw(b"\x10\x32\x54\x76", 1, 1, 4, 2, framebuf_plus.GS4_HLSB)
+        self.assertEqual([self.fb.pixel(x, 2) for x in range(1, 5)], [4, 5, 6, 7])
+        # converted from GS8
+        self.fb.load_raw(bytes([0, 255]), 0, 0, 2, 1, framebuf_plus.GS8)
+        self.assertEqual((self.fb.pixel(0, 0), self.fb.pixel(1, 0)), (0, 15))
+
+    def test_bmp(self):
+        fb = framebuf_plus.FrameBuffer(bytearray(16 * 4), 16, 4, framebuf_plus.GS8)
+        row = lambda y, n: [fb.pixel(x, y) for x in range(n)]
+        # bottom-up, 8-bit with a 3 colour palette that isn't a gray ramp
+        palette = b"\x00\x00\x00\x00\xc8\xc8\xc8\x00\x64\x64\x64\x00"
+        self.assertEqual(fb.bmp(bmp_file(3, 2, 8, [b"\x01\x02\x00\x00", b"\x02\x00\x01\x00"], palette)), (3, 2))
+        self.assertEqual((row(0, 4), row(1, 4)), ([100, 0, 200, 0], [200, 100, 0, 0]))
+        # top-down, 4-bit gray ramp
+        ramp = b"".join(bytes([g * 17] * 3 + [0]) for g in range(16))
+        fb.bmp(bmp_file(3, -1, 4, [b"\x3c\xf0\x00\x00"], ramp))
+        self.assertEqual(row(0, 3), [51, 204, 255])
+        # RGB555 and RGB565 rows, the 5 and 6 bit channels widened by repeating their top bits
+        fb.bmp(bmp_file(3, 1, 16, [struct.pack("<HHHH", 0x7fff, 0x0000, 0x4210, 0)]))
+        self.assertEqual(row(0, 3), [255, 0, 132])
+        masks = struct.pack("<III", 0xf800, 0x07e0, 0x001f)
+        fb.bmp(bmp_file(2, 1, 16, [struct.pack("<HH", 0xffff, 0x8410)], masks=masks, compression=3))
+        self.assertEqual(row(0, 2), [255, 130])
+        # the masks must follow a 40-byte header or be in it
+        with self.assertRaises(RuntimeError):
+            fb.bmp(bmp_file(2, 1, 16, [bytes(4)], compression=3, hsize=44))
+        # 1-bit with white as colour 0, read straight into MONO_HLSB and inverted
+        mono = framebuf_plus.FrameBuffer(bytearray(2 * 2), 16, 2, framebuf_plus.MONO_HLSB)
+        mono.bmp(bmp_file(10, 1, 1, [b"\xa0\x40\x00\x00"], b"\xff\xff\xff\x00\x00\x00\x00\x00"))
+        self.assertEqual([mono.pixel(x, 0) for x in range(11)], [0, 1, 0, 1, 1, 1, 1, 1, 1, 0, 0])
+
+    def test_pgm(self):
+        fb = framebuf_plus.FrameBuffer(bytearray(16 * 4), 16, 4, framebuf_plus.GS8)
+        # 8-bit samples scaled from maxval, 16-bit ones big-endian
+        self.assertEqual(fb.pgm(b"P5\n3 1\n15\n\x00\x05\x0f"), (3, 1))
+        self.assertEqual([fb.pixel(x, 0) for x in range(3)], [0, 85, 255])
+        fb.pgm(b"P5 2 1 65535\n\xff\xff\x80\x80", 0, 1)
+        self.assertEqual([fb.pixel(x, 1) for x in range(2)], [255, 128])
+        # P4 stores black as 1, rows padded to a byte
+        pbm = b"P4\n# 10x2\n10 2\n\xa0\x40\x00\x80"
+        self.assertEqual(fb.pgm(pbm, 0, 2), (10, 2))
+        self.assertEqual([fb.pixel(x, 2) for x in (0, 1, 2, 9)] + [fb.pixel(x, 3) for x in (0, 8, 9)], [0, 255, 0, 0, 255, 0, 255])
+        mono = framebuf_plus.FrameBuffer(bytearray(2 * 2), 16, 2, framebuf_plus.MONO_HLSB)
+        mono.pgm(pbm)
+        self.assertEqual([mono.pixel(x, y) for y in range(2) for x in (0, 1, 8, 9)], [0, 1, 1, 0, 1, 1, 0, 1])
+
+    def test_convert_from(self):
+        src = framebuf_plus.FrameBuffer(bytearray(64 * 8), 64, 8, framebuf_plus.GS8)
+        for x in range(64):
+            src.vline(x, 0, 8, x * 4)
+        mono = framebuf_plus.FrameBuffer(bytearray(64), 64, 8, framebuf_plus.MONO_HLSB)
+        mono.convert_from(src, dither=framebuf_plus.DITHER_FLOYD)
+        # about half of the pixels of a black to white gradient are set
+        ones = sum(mono.pixel(x, y) for y in range(8) for x in range(64))
+        self.assertTrue(200 < ones < 300)
+        self.fb.convert_from(src, 0, 450, dither=framebuf_plus.DITHER_BAYER)
+
+    def test_tone(self):
+        src = framebuf_plus.FrameBuffer(bytearray(16), 16, 1, framebuf_plus.GS8)
+        for x in range(16):
+            src.pixel(x, 0, x * 17)
+        dst = framebuf_plus.FrameBuffer(bytearray(16), 16, 1, framebuf_plus.GS8)
+        dst.tone(bytes(255 - i for i in range(256)))
+        dst.convert_from(src)
+        self.assertEqual([dst.pixel(x, 0) for x in range(16)], [255 - x * 17 for x in range(16)])
+        dst.tone()
+        dst.convert_from(src)
+        self.assertEqual(dst.pixel(15, 0), 255)
+        with self.assertRaises(ValueError):
+            dst.tone(bytes(16))
+
+    def test_jpg_dither(self):
+        for fmt, size in ((framebuf_plus.MONO_HLSB, 32), (framebuf_plus.GS2_HMSB, 64)):
+            fb = framebuf_plus.FrameBuffer(bytearray(size), 16, 16, fmt)
+            for dither in (framebuf_plus.DITHER_NONE, framebuf_plus.DITHER_FLOYD, framebuf_plus.DITHER_ATKINSON, framebuf_plus.DITHER_BAYER):
+                self.assertEqual(fb.jpg(JPG_GRAY, 0, 0, dither=dither), (16, 16))
+                levels = {}
+                for i in range(256):
+                    c = fb.pixel(i % 16, i // 16)
+                    levels[c] = levels.get(c, 0) + 1
+                if dither == framebuf_plus.DITHER_NONE:
+                    self.assertEqual(len(levels), 1)
+                else:
+                    # mid gray falls between two levels, dithered about half and half
+                    self.assertEqual(len(levels), 2)
+                    self.assertTrue(96 <= min(levels.values()) <= 128)
+
+    def test_save(self):
+        self.fb.fill_rect(0, 0, 80, 40, 15)
+        self.fb.rect(0, 0, 64, 32, 0, True)
+        # a run of levels across the byte boundary at x = 64
+        for x in range(60, 68):
+            self.fb.pixel(x, 32, x - 56)
+        self.fb.save_png("shot.png")
+        self.fb.save_pgm("shot.pgm")
+        # loaded back into the top left corner of a smaller frame buffer
+        for load in ("png", "pgm"):
+            fb = framebuf_plus.FrameBuffer(bytearray(80 * 40 // 2), 80, 40, framebuf_plus.GS4_HLSB)
+            self.assertEqual(getattr(fb, load)("shot." + load), (960, 540))
+            self.assertEqual((fb.pixel(0, 0), fb.pixel(63, 31), fb.pixel(64, 31), fb.pixel(0, 32)), (0, 0, 15, 15))
+            self.assertEqual([fb.pixel(x, 32) for x in range(59, 69)], [15, 4, 5, 6, 7, 8, 9, 10, 11, 15])
+            self.assertTrue(all(fb.pixel(x, y) == self.fb.pixel(x, y) for y in range(40) for x in range(80)))
+        os.remove("shot.png")
+        os.remove("shot.pgm")
+
+    @unittest.skipUnless(is_test_png, "No test.png file, skip")
+    def test_png(self):
+        w, h = self.fb.png("test.png", 0, 0)
+        with open("test.png", "rb") as f:
+            self.assertEqual(self.fb.png(f.read(), w, 0), (w, h))
+
 if __name__ == "__main__":
     unittest.main()
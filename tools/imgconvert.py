@@ -0,0 +1,237 @@
+#!python3
+from PIL import Image
+import sys
+import argparse
+
+# frame buffer formats, the values of the framebuf_plus constants
+FORMATS = {
+    "MONO_VLSB": 0,
+    "RGB565": 1,
+    "GS4_HMSB": 2,
+    "MONO_HLSB": 3,
+    "MONO_HMSB": 4,
+    "GS2_HMSB": 5,
+    "GS8": 6,
+    "GS4_HLSB": 7,
+    "RGB888": 8,
+}
+MVLSB, RGB565, GS4_HMSB, MHLSB, MHMSB, GS2_HMSB, GS8, GS4_HLSB, RGB888 = range(9)
+
+# gray levels of each format, 0 for colour formats
+LEVELS = {MVLSB: 2, MHLSB: 2, MHMSB: 2, GS2_HMSB: 4, GS4_HMSB: 16, GS4_HLSB: 16, GS8: 256, RGB565: 0, RGB888: 0}
+
+parser = argparse.ArgumentParser(description="Convert an image to the buffer of a framebuf_plus FrameBuffer.")
+parser.add_argument("name", action="store", help="name of the generated image.")
+parser.add_argument("image", action="store", help="image file, PNG, JPEG or anything Pillow reads.")
+parser.add_argument("--format", dest="format", choices=FORMATS.keys(), default="GS4_HLSB", help="frame buffer format (default GS4_HLSB).")
+parser.add_argument("--dither", dest="dither", choices=["none", "floyd", "atkinson", "bayer"], default="none", help="dithering of the quantized levels.")
+parser.add_argument("--crop", dest="crop", action="store", help="x,y,w,h region of the image to convert.")
+parser.add_argument("--resize", dest="resize", action="store", help="WxH size of the converted image, after cropping.")
+parser.add_argument("--background", dest="background", action="store", default="white", help="colour behind transparent pixels (default white).")
+parser.add_argument("--rle", dest="rle", action="store_true", help="compress each row with PackBits.")
+parser.add_argument("--raw", dest="raw", action="store_true", help="write a binary file instead of a python module.")
+args = parser.parse_args()
+
+fmt = FORMATS[args.format]
+
+def load_image(path):
+    img = Image.open(path)
+    if img.mode in ("RGBA", "LA", "P"):
+        img = img.convert("RGBA")
+        bg = Image.new("RGBA", img.size, args.background)
+        img = Image.alpha_composite(bg, img)
+    img = img.convert("RGB")
+    if args.crop:
+        x, y, w, h = (int(v) for v in args.crop.split(","))
+        img = img.crop((x, y, x + w, y + h))
+    if args.resize:
+        w, h = (int(v) for v in args.resize.lower().split("x"))
+        img = img.resize((w, h), Image.LANCZOS)
+    return img
+
+# the same luma as the frame buffer loaders, so that converted images match fb.bmp() and fb.pgm()
+def luma(r, g, b):
+    return (r * 38 + g * 75 + b * 15) >> 7
+
+BAYER = (
+    (0, 8, 2, 10),
+    (12, 4, 14, 6),
+    (3, 11, 1, 9),
+    (15, 7, 13, 5),
+)
+
+# error diffusion: (dx, dy, weight) and divisor
+DIFFUSION = {
+    "floyd": (((1, 0, 7), (-1, 1, 3), (0, 1, 5), (1, 1, 1)), 16),
+    "atkinson": (((1, 0, 1), (2, 0, 1), (-1, 1, 1), (0, 1, 1), (1, 1, 1), (0, 2, 1)), 8),
+}
+
+def quantize(plane, w, h, levels):
+    """Quantizes a plane of 0..255 values to levels, returns the level indices."""
+    out = [[0] * w for _ in range(h)]
+    step = 255 / (levels - 1)
+    if args.dither == "none":
+        # truncated like the loaders, e.g. luma >> 4 for 16 levels
+        shift = 8 - (levels - 1).bit_length()
+        for y in range(h):
+            out[y] = [int(v) >> shift for v in plane[y]]
+    elif args.dither == "bayer":
+        for y in range(h):
+            for x in range(w):
+                t = (BAYER[y & 3][x & 3] + 0.5) / 16 - 0.5
+                out[y][x] = min(levels - 1, max(0, int(plane[y][x] / step + t + 0.5)))
+    else:
+        taps, div = DIFFUSION[args.dither]
+        err = [list(map(float, row)) for row in plane]
+        for y in range(h):
+            for x in range(w):
+                q = min(levels - 1, max(0, int(err[y][x] / step + 0.5)))
+                out[y][x] = q
+                e = (err[y][x] - q * step) / div
+                for dx, dy, k in taps:
+                    if 0 <= x + dx < w and y + dy < h:
+                        err[y + dy][x + dx] += e * k
+    return out
+
+def native_pixels(img):
+    """Returns the rows of native colours of the image in fmt."""
+    w, h = img.size
+    data = img.tobytes()
+    px = [tuple(data[i:i + 3]) for i in range(0, len(data), 3)]
+    rows = [px[y * w:(y + 1) * w] for y in range(h)]
+    if fmt == RGB888:
+        return [[(r << 16) | (g << 8) | b for r, g, b in row] for row in rows]
+    if fmt == RGB565:
+        r = quantize([[p[0] for p in row] for row in rows], w, h, 32)
+        g = quantize([[p[1] for p in row] for row in rows], w, h, 64)
+        b = quantize([[p[2] for p in row] for row in rows], w, h, 32)
+        return [[(r[y][x] << 11) | (g[y][x] << 5) | b[y][x] for x in range(w)] for y in range(h)]
+    return quantize([[luma(*p) for p in row] for row in rows], w, h, LEVELS[fmt])
+
+def stride_of(w):
+    """Stride in pixels as FrameBuffer rounds it, in bytes for RGB888."""
+    if fmt in (MVLSB, RGB565, MHLSB, MHMSB):
+        return (w + 7) & ~7
+    if fmt == GS2_HMSB:
+        return (w + 3) & ~3
+    if fmt in (GS4_HMSB, GS4_HLSB):
+        return (w + 1) & ~1
+    if fmt == RGB888:
+        return w * 3
+    return w
+
+def pack(pixels, w, h):
+    """Lays the pixels out as the setpixel functions of the format do."""
+    stride = stride_of(w)
+    if fmt == MVLSB:
+        buf = bytearray(stride * ((h + 7) // 8))
+    elif fmt == RGB888:
+        buf = bytearray(stride * h)
+    else:
+        bits = {RGB565: 16, GS8: 8, GS4_HMSB: 4, GS4_HLSB: 4, GS2_HMSB: 2}.get(fmt, 1)
+        buf = bytearray(stride * h * bits // 8)
+    for y in range(h):
+        for x in range(w):
+            c = pixels[y][x]
+            if fmt == MVLSB:
+                buf[(y >> 3) * stride + x] |= c << (y & 7)
+            elif fmt in (MHLSB, MHMSB):
+                offset = x & 7 if fmt == MHMSB else 7 - (x & 7)
+                buf[(x + y * stride) >> 3] |= c << offset
+            elif fmt == GS2_HMSB:
+                buf[(x + y * stride) >> 2] |= c << ((x & 3) << 1)
+            elif fmt in (GS4_HMSB, GS4_HLSB):
+                high = (x & 1) == (fmt == GS4_HLSB)
+                buf[(x + y * stride) >> 1] |= c << 4 if high else c
+            elif fmt == GS8:
+                buf[x + y * stride] = c
+            elif fmt == RGB565:
+                i = (x + y * stride) * 2
+                buf[i:i + 2] = c.to_bytes(2, "little")
+            else:
+                i = 3 * x + y * stride
+                buf[i:i + 3] = c.to_bytes(3, "little")
+    return bytes(buf)
+
+def packbits(row):
+    """PackBits: n < 128 is followed by n + 1 literal bytes, n > 128 repeats the next byte 257 - n times."""
+    out = bytearray()
+    i = 0
+    while i < len(row):
+        run = 1
+        while i + run < len(row) and run < 128 and row[i + run] == row[i]:
+            run += 1
+        if run > 1:
+            out += bytes((257 - run, row[i]))
+            i += run
+            continue
+        j = i + 1
+        while j < len(row) and j - i < 128 and (j + 1 >= len(row) or row[j] != row[j + 1]):
+            j += 1
+        out.append(j - i - 1)
+        out += row[i:j]
+        i = j
+    return bytes(out)
+
+def chunks(l, n):
+    for i in range(0, len(l), n):
+        yield l[i:i + n]
+
+img = load_image(args.image)
+width, height = img.size
+data = pack(native_pixels(img), width, height)
+
+# rows, or 8-row pages for MONO_VLSB
+band = 8 if fmt == MVLSB else 1
+row_bytes = len(data) // ((height + band - 1) // band)
+if args.rle:
+    data = b"".join(packbits(row) for row in chunks(data, row_bytes))
+
+print("size", width, "x", height, file=sys.stderr)
+print("bytes", row_bytes * ((height + band - 1) // band), file=sys.stderr)
+if args.rle:
+    print("compressed", len(data), file=sys.stderr)
+
+if args.raw:
+    with open("{}.raw".format(args.name), "wb") as f:
+        f.write(data)
+    sys.exit(0)
+
+f = open("{}.py".format(args.name), "w")
+f.write("# {} from {}\n".format(args.name, args.image))
+f.write("import framebuf_plus\n\n")
+f.write("WIDTH = {}\n".format(width))
+f.write("HEIGHT = {}\n".format(height))
+f.write("FORMAT = framebuf_plus.{}\n".format(args.format))
+f.write("ROW_BYTES = {}\n".format(row_bytes))
+f.write("RLE = {}\n\n".format("True" if args.rle else "False"))
+f.write("DATA =")
+for c in chunks(data, 16):
+    f.write(" \\\n")
+    f.write("    " + "b\'" + "".join(f"\\x{b:02X}" for b in c) + "'")
+f.write("\n\n")
+f.write('''def draw(fb, x=0, y=0):
+    if not RLE:
+        fb.load_raw(DATA, x, y, WIDTH, HEIGHT, FORMAT)
+        return
+    band = 8 if FORMAT == framebuf_plus.MONO_VLSB else 1
+    row = bytearray(ROW_BYTES)
+    i = 0
+    for yy in range(0, HEIGHT, band):
+        n = 0
+        while n < ROW_BYTES:
+            c = DATA[i]
+            if c < 128:
+                row[n:n + c + 1] = DATA[i + 1:i + c + 2]
+                n += c + 1
+                i += c + 2
+            elif c > 128:
+                for k in range(257 - c):
+                    row[n + k] = DATA[i + 1]
+                n += 257 - c
+                i += 2
+            else:
+                i += 1
+        fb.load_raw(row, x, y + yy, WIDTH, min(band, HEIGHT - yy), FORMAT)
+''')
+f.close()